@@ -23,7 +23,7 @@ public:
 
 private:
   font_inst* f;
-  wstring text;
+  text_block block; //laid out again only when the text or size changes
   vec4 base_color, base_highlight_color;
   mat4 base_transformation;
   float base_line_height;
@@ -202,8 +202,12 @@ public:
       filter_value = 1;
 
     m = create_translation( p ) * create_rotation( r, vec3( 0, 0, 1 ) ) * create_scale( sc );
-    font::get().set_size( *f, s );
-    font::get().add_to_render_list( text, *f, c, m, h, l, filter_value );
+    block.set_font( *f, s, l );
+    block.set_transform( m );
+    block.set_color( c );
+    block.set_highlight_color( h );
+    block.set_filter( filter_value );
+    font::get().add_to_render_list( block );
   }
 
   animation()
@@ -220,7 +224,6 @@ public:
     is_playing = false;
     is_looping = false;
     do_display = false;
-    text = L"";
     start_pos = vec3( 0 );
     end_pos = vec3( 0 );
     start_rotation = 0;
@@ -328,9 +331,14 @@ public:
     duration = t;
   }
 
-  void set_text( wstring s )
+  void set_text( const utf8_view& s )
   {
-    text = s;
+    block.set_text( s );
+  }
+
+  void set_text( const wstring& s )
+  {
+    block.set_text( s );
   }
 
   void set_font_size( int s )
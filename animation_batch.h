@@ -0,0 +1,689 @@
+#ifndef animation_batch_h
+#define animation_batch_h
+
+#include "mymath/mymath.h"
+#include "font.h"
+#include "transition.h"
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <functional>
+
+//what a track of an animation_batch starts with, the defaults are the
+//same as animation's
+struct anim_track
+{
+  font_inst* f;
+  unsigned props; //animation_batch::prop bits, same as animation::anim
+  float duration;
+  bool loop; //back and forth until removed
+  int repeat_amount; //ends before turning back, without loop
+  mm::vec4 color, highlight_color;
+  float line_height;
+  int font_size; //without SIZE
+  mm::vec3 start_pos, end_pos;
+  float start_rotation, end_rotation; //radians
+  mm::vec3 start_scale, end_scale;
+  int start_size, end_size;
+  transition::func trans[5]; //by property, 0 is linear
+
+  anim_track() : f( 0 ), props( 0 ), duration( 0 ), loop( false ), repeat_amount( 1 ), color( 1 ), highlight_color( 0 ), line_height( 1 ), font_size( 20 ),
+    start_pos( 0 ), end_pos( 0 ), start_rotation( 0 ), end_rotation( 0 ), start_scale( 1 ), end_scale( 1 ), start_size( 20 ), end_size( 20 )
+  {
+    for( int c = 0; c < 5; ++c )
+      trans[c] = 0;
+  }
+};
+
+//animated texts, evaluated together
+//tracks are kept in struct of arrays form, grouped by the properties they
+//animate, so a group runs through the same code for every track without
+//branching on them, and the math goes 4 tracks at a time in mm::vec4
+//lanes (sse when mymath is built with MYMATH_USE_SSE2)
+//only the ends of the timeline (turning back, repeats, chains) are
+//handled track by track, they are rare
+//a group keeps its playing tracks first, then the paused or finished ones
+//that are still shown, then the hidden ones, only the playing ones are
+//advanced and evaluated, the shown ones are drawn as they were left
+//delayed and chained starts wait in a min heap by their start time
+class animation_batch
+{
+public:
+  enum prop : unsigned
+  {
+    ALPHA = ( 1 << 0 ),
+    POSITION = ( 1 << 1 ),
+    ROTATION = ( 1 << 2 ),
+    SCALE = ( 1 << 3 ),
+    SIZE = ( 1 << 4 )
+  };
+
+private:
+  enum
+  {
+    NUM_PROPS = 5
+  };
+
+  //the animated values, from + delta * eased time each,
+  //alpha goes from 0 to 1 like in animation
+  enum channel
+  {
+    CH_ALPHA, CH_POS_X, CH_POS_Y, CH_POS_Z, CH_ROTATION, CH_SCALE_X, CH_SCALE_Y, CH_SCALE_Z, CH_SIZE, NUM_CHANNELS
+  };
+
+  //the things the tight loops don't touch
+  struct track_info
+  {
+    font_inst* f;
+    text_block* block;
+    mm::vec4 color, highlight_color;
+    float line_height;
+    int font_size;
+    bool loop;
+    int repeat_amount, repeat_counter;
+  };
+
+  struct group
+  {
+    size_t count;
+    size_t playing, shown; //[0, playing) play, [playing, shown) are shown as they are, the rest is hidden
+    //4 tracks a lane, the lanes past count are idle
+    std::vector<mm::vec4> time, duration, direction, speed; //speed is 1 playing, 0 not
+    std::vector<mm::vec4> from[NUM_CHANNELS], delta[NUM_CHANNELS]; //only the animated ones
+    std::vector<transition::func> trans[NUM_PROPS]; //a track each, only the animated ones
+    std::vector<unsigned> easings[NUM_PROPS]; //transition::easing of trans
+    std::vector<unsigned> ids;
+    std::vector<track_info> info;
+  };
+
+  struct slot
+  {
+    unsigned props; //group
+    unsigned index; //in the group, ~0u if the id is free
+  };
+
+  //a start that waits, at an absolute time
+  typedef std::pair<double, unsigned> timer;
+
+  group groups[1 << NUM_PROPS]; //by props
+  std::vector<slot> slots; //by id
+  std::vector<unsigned> free_ids;
+  std::vector< std::pair<unsigned, unsigned> > chains; //from, to
+  std::vector<timer> timers; //min heap
+  std::vector<unsigned> ended; //stopped playing this update, they sleep after it's drawn
+  std::vector<mm::vec4> eased[NUM_PROPS]; //scratch, a lane each
+  bool easing_tables; //see set_easing_tables
+  double now; //seconds, sum of the update dts
+  float frame_dt; //of the update being run
+
+  static unsigned channel_prop( unsigned ch )
+  {
+    static const unsigned props[NUM_CHANNELS] = { ALPHA, POSITION, POSITION, POSITION, ROTATION, SCALE, SCALE, SCALE, SIZE };
+    return props[ch];
+  }
+
+  static unsigned prop_index( unsigned ch )
+  {
+    static const unsigned index[NUM_CHANNELS] = { 0, 1, 1, 1, 2, 3, 3, 3, 4 };
+    return index[ch];
+  }
+
+  static float& lane( std::vector<mm::vec4>& v, size_t i )
+  {
+    return v[i / 4][unsigned( i % 4 )];
+  }
+
+  static void swap_lanes( std::vector<mm::vec4>& v, size_t a, size_t b )
+  {
+    std::swap( lane( v, a ), lane( v, b ) );
+  }
+
+  //grows the lanes so there's room for one more track
+  void grow( group& g, unsigned props )
+  {
+    if( g.count % 4 != 0 )
+      return;
+
+    g.time.push_back( mm::vec4( 0 ) );
+    g.duration.push_back( mm::vec4( 1 ) );
+    g.direction.push_back( mm::vec4( 1 ) );
+    g.speed.push_back( mm::vec4( 0 ) );
+
+    for( unsigned c = 0; c < NUM_CHANNELS; ++c )
+    {
+      if( props & channel_prop( c ) )
+      {
+        g.from[c].push_back( mm::vec4( 0 ) );
+        g.delta[c].push_back( mm::vec4( 0 ) );
+      }
+    }
+
+    for( unsigned p = 0; p < NUM_PROPS; ++p )
+    {
+      if( props & ( 1u << p ) )
+      {
+        g.trans[p].resize( g.trans[p].size() + 4, transition::linear );
+        g.easings[p].resize( g.easings[p].size() + 4, transition::LINEAR );
+      }
+    }
+  }
+
+  void swap_tracks( group& g, unsigned props, size_t a, size_t b )
+  {
+    if( a == b )
+      return;
+
+    swap_lanes( g.time, a, b );
+    swap_lanes( g.duration, a, b );
+    swap_lanes( g.direction, a, b );
+    swap_lanes( g.speed, a, b );
+
+    for( unsigned c = 0; c < NUM_CHANNELS; ++c )
+    {
+      if( props & channel_prop( c ) )
+      {
+        swap_lanes( g.from[c], a, b );
+        swap_lanes( g.delta[c], a, b );
+      }
+    }
+
+    for( unsigned p = 0; p < NUM_PROPS; ++p )
+    {
+      if( props & ( 1u << p ) )
+      {
+        std::swap( g.trans[p][a], g.trans[p][b] );
+        std::swap( g.easings[p][a], g.easings[p][b] );
+      }
+    }
+
+    std::swap( g.ids[a], g.ids[b] );
+    std::swap( g.info[a], g.info[b] );
+    slots[g.ids[a]].index = unsigned( a );
+    slots[g.ids[b]].index = unsigned( b );
+  }
+
+  //moves a track between the playing, shown and hidden parts of its
+  //group, one boundary at a time
+  void set_playing( unsigned id )
+  {
+    slot& s = slots[id];
+    group& g = groups[s.props];
+
+    if( s.index >= g.shown )
+      swap_tracks( g, s.props, s.index, g.shown++ );
+
+    if( s.index >= g.playing )
+      swap_tracks( g, s.props, s.index, g.playing++ );
+
+    lane( g.speed, s.index ) = 1;
+  }
+
+  void set_shown( unsigned id )
+  {
+    slot& s = slots[id];
+    group& g = groups[s.props];
+
+    if( s.index >= g.shown )
+      swap_tracks( g, s.props, s.index, g.shown++ );
+
+    if( s.index < g.playing )
+      swap_tracks( g, s.props, s.index, --g.playing );
+
+    lane( g.speed, s.index ) = 0;
+  }
+
+  void set_hidden( unsigned id )
+  {
+    slot& s = slots[id];
+    group& g = groups[s.props];
+
+    if( s.index < g.playing )
+      swap_tracks( g, s.props, s.index, --g.playing );
+
+    if( s.index < g.shown )
+      swap_tracks( g, s.props, s.index, --g.shown );
+
+    lane( g.speed, s.index ) = 0;
+  }
+
+  void add_timer( double at, unsigned id )
+  {
+    timers.push_back( timer( at, id ) );
+    std::push_heap( timers.begin(), timers.end(), std::greater<timer>() );
+  }
+
+  void remove_timers( unsigned id )
+  {
+    size_t n = timers.size();
+    timers.erase( std::remove_if( timers.begin(), timers.end(), [id]( const timer & t )
+    {
+      return t.second == id;
+    } ), timers.end() );
+
+    if( timers.size() != n )
+      std::make_heap( timers.begin(), timers.end(), std::greater<timer>() );
+  }
+
+  //the end of the timeline was hit, turns back, counts the repeats and
+  //stops, over is how far past the end the track went this update
+  void bounce( group& g, size_t i, bool at_end, float over )
+  {
+    track_info& info = g.info[i];
+
+    //the chained tracks start when this one ended, not at the next update
+    if( at_end )
+    {
+      for( auto& c : chains )
+      {
+        if( c.first == g.ids[i] )
+          add_timer( now + frame_dt - over, c.second );
+      }
+    }
+
+    float& dir = lane( g.direction, i );
+
+    if( info.loop )
+    {
+      dir = -dir;
+      return;
+    }
+
+    ++info.repeat_counter;
+
+    if( info.repeat_counter < info.repeat_amount )
+    {
+      dir = -dir;
+    }
+    else
+    {
+      //stays shown where it ended
+      lane( g.time, i ) = at_end ? lane( g.duration, i ) : 0;
+      lane( g.speed, i ) = 0;
+      ended.push_back( g.ids[i] );
+    }
+  }
+
+  void advance( group& g, float dt )
+  {
+    size_t lanes = ( g.playing + 3 ) / 4;
+    mm::vec4 zero( 0 ), one( 1 );
+
+    for( size_t l = 0; l < lanes; ++l )
+    {
+      mm::vec4 dur = g.duration[l];
+      mm::vec4 raw = g.time[l] + g.direction[l] * g.speed[l] * dt;
+
+      //past either end it's mirrored back, idle lanes never hit
+      mm::vec4 over = mm::step( dur, raw ) * g.speed[l];
+      mm::vec4 under = ( one - mm::step( zero, raw ) ) * g.speed[l];
+      mm::vec4 t = mm::mix( raw, dur * 2 - raw, over );
+      t = mm::mix( t, -t, under );
+      g.time[l] = mm::clamp( t, zero, dur );
+
+      mm::vec4 hit = over + under;
+
+      if( hit.x + hit.y + hit.z + hit.w > 0 )
+      {
+        for( unsigned k = 0; k < 4; ++k )
+        {
+          if( hit[k] > 0 )
+            bounce( g, l * 4 + k, over[k] > 0, over[k] > 0 ? raw[k] - dur[k] : -raw[k] );
+        }
+      }
+    }
+  }
+
+  void evaluate( group& g, unsigned props )
+  {
+    size_t lanes = ( g.playing + 3 ) / 4;
+
+    //4 tracks with the same known easing go through its vec4 kernel
+    //where that's faster (transition::prefers_ease4), everything else
+    //one track at a time
+    for( unsigned p = 0; p < NUM_PROPS; ++p )
+    {
+      if( !( props & ( 1u << p ) ) )
+        continue;
+
+      if( eased[p].size() < lanes )
+        eased[p].resize( lanes );
+
+      for( size_t l = 0; l < lanes; ++l )
+      {
+        mm::vec4 x = g.time[l] / g.duration[l];
+        mm::vec4& e = eased[p][l];
+        const transition::func* f = &g.trans[p][l * 4];
+        const unsigned* id = &g.easings[p][l * 4];
+        unsigned n = unsigned( std::min( size_t( 4 ), g.playing - l * 4 ) );
+        bool same = id[0] != transition::CUSTOM;
+
+        for( unsigned k = 1; k < n; ++k )
+          same = same && id[k] == id[0];
+
+        if( same && transition::prefers_ease4( id[0] ) && !( easing_tables && transition::is_expensive( id[0] ) ) )
+        {
+          e = transition::ease4( id[0], x );
+          continue;
+        }
+
+        for( unsigned k = 0; k < 4; ++k )
+          e[k] = easing_tables && transition::is_expensive( id[k] ) ? transition::ease_table( id[k], x[k] ) : f[k]( x[k] );
+      }
+    }
+
+    mm::vec4 zero( 0 ), one( 1 );
+
+    for( size_t l = 0; l < lanes; ++l )
+    {
+      mm::vec4 v[NUM_CHANNELS];
+
+      for( unsigned c = 0; c < NUM_CHANNELS; ++c )
+      {
+        if( props & channel_prop( c ) )
+          v[c] = g.from[c][l] + g.delta[c][l] * eased[prop_index( c )][l];
+      }
+
+      //translation * rotation around z * scale, a column each
+      mm::vec4 px = props & POSITION ? v[CH_POS_X] : zero;
+      mm::vec4 py = props & POSITION ? v[CH_POS_Y] : zero;
+      mm::vec4 pz = props & POSITION ? v[CH_POS_Z] : zero;
+      mm::vec4 sx = props & SCALE ? v[CH_SCALE_X] : one;
+      mm::vec4 sy = props & SCALE ? v[CH_SCALE_Y] : one;
+      mm::vec4 sz = props & SCALE ? v[CH_SCALE_Z] : one;
+      mm::vec4 c = props & ROTATION ? mm::cos( v[CH_ROTATION] ) : one;
+      mm::vec4 s = props & ROTATION ? mm::sin( v[CH_ROTATION] ) : zero;
+
+      mm::vec4 m00 = c * sx, m01 = s * sx;
+      mm::vec4 m10 = -s * sy, m11 = c * sy;
+
+      //the same blur in and out as animation, 1 - circular_in and
+      //circular_out of the two halves both come down to this
+      mm::vec4 ft = g.time[l] / g.duration[l] * 2 - one;
+      mm::vec4 filter = mm::sqrt( mm::max( zero, one - ft * ft ) );
+
+      size_t end = std::min( g.playing, l * 4 + 4 );
+
+      for( size_t i = l * 4; i < end; ++i )
+      {
+        track_info& info = g.info[i];
+        unsigned k = unsigned( i % 4 );
+
+        mm::mat4 m( m00[k], m01[k], 0, 0,
+                    m10[k], m11[k], 0, 0,
+                    0, 0, sz[k], 0,
+                    px[k], py[k], pz[k], 1 );
+
+        mm::vec4 color = info.color;
+
+        if( props & ALPHA )
+          color.w = v[CH_ALPHA][k];
+
+        float size = props & SIZE ? v[CH_SIZE][k] : (float)info.font_size;
+        bool scaled = sx[k] != 1 || sy[k] != 1 || sz[k] != 1;
+
+        text_block& b = *info.block;
+        b.set_font( *info.f, unsigned( size ), info.line_height );
+        b.set_transform( m );
+        b.set_color( color );
+        b.set_highlight_color( info.highlight_color );
+        b.set_filter( scaled ? 1 : filter[k] );
+        font::get().add_to_render_list( b );
+      }
+    }
+  }
+
+  animation_batch( const animation_batch& );
+  animation_batch& operator=( const animation_batch& );
+protected:
+public:
+  //returns the id of the track, it's hidden until played
+  unsigned add( const anim_track& a, const utf8_view& text )
+  {
+    unsigned props = a.props & ( ( 1u << NUM_PROPS ) - 1 );
+    group& g = groups[props];
+    grow( g, props );
+
+    size_t i = g.count++;
+
+    lane( g.time, i ) = 0;
+    lane( g.duration, i ) = a.duration > 0 ? a.duration : 1e-6f;
+    lane( g.direction, i ) = 1;
+    lane( g.speed, i ) = 0;
+
+    const float from[NUM_CHANNELS] = { 0, a.start_pos.x, a.start_pos.y, a.start_pos.z, a.start_rotation, a.start_scale.x, a.start_scale.y, a.start_scale.z, (float)a.start_size };
+    const float to[NUM_CHANNELS] = { 1, a.end_pos.x, a.end_pos.y, a.end_pos.z, a.end_rotation, a.end_scale.x, a.end_scale.y, a.end_scale.z, (float)a.end_size };
+
+    for( unsigned c = 0; c < NUM_CHANNELS; ++c )
+    {
+      if( props & channel_prop( c ) )
+      {
+        lane( g.from[c], i ) = from[c];
+        lane( g.delta[c], i ) = to[c] - from[c];
+      }
+    }
+
+    for( unsigned p = 0; p < NUM_PROPS; ++p )
+    {
+      if( props & ( 1u << p ) )
+      {
+        g.trans[p][i] = a.trans[p] ? a.trans[p] : transition::linear;
+        g.easings[p][i] = transition::find( g.trans[p][i] );
+      }
+    }
+
+    track_info info;
+    info.f = a.f;
+    info.block = new text_block();
+    info.block->set_text( text );
+    info.color = a.color;
+    info.highlight_color = a.highlight_color;
+    info.line_height = a.line_height;
+    info.font_size = a.font_size;
+    info.loop = a.loop;
+    info.repeat_amount = a.repeat_amount;
+    info.repeat_counter = 0;
+
+    unsigned id;
+
+    if( !free_ids.empty() )
+    {
+      id = free_ids.back();
+      free_ids.pop_back();
+    }
+    else
+    {
+      id = unsigned( slots.size() );
+      slots.push_back( slot() );
+    }
+
+    slots[id].props = props;
+    slots[id].index = unsigned( i );
+    g.ids.push_back( id );
+    g.info.push_back( info );
+
+    return id;
+  }
+
+  void remove( unsigned id )
+  {
+    set_hidden( id );
+    remove_timers( id );
+
+    slot& s = slots[id];
+    group& g = groups[s.props];
+    size_t last = g.count - 1;
+
+    //the hidden tracks are last, so the tail stays in order
+    swap_tracks( g, s.props, s.index, last );
+    delete g.info[last].block;
+
+    //the freed lane goes idle
+    lane( g.speed, last ) = 0;
+    lane( g.duration, last ) = 1;
+    g.ids.pop_back();
+    g.info.pop_back();
+    --g.count;
+
+    if( g.count % 4 == 0 )
+    {
+      size_t lanes = g.count / 4;
+      g.time.resize( lanes );
+      g.duration.resize( lanes );
+      g.direction.resize( lanes );
+      g.speed.resize( lanes );
+
+      for( unsigned c = 0; c < NUM_CHANNELS; ++c )
+      {
+        if( s.props & channel_prop( c ) )
+        {
+          g.from[c].resize( lanes );
+          g.delta[c].resize( lanes );
+        }
+      }
+
+      for( unsigned p = 0; p < NUM_PROPS; ++p )
+      {
+        if( s.props & ( 1u << p ) )
+        {
+          g.trans[p].resize( lanes * 4 );
+          g.easings[p].resize( lanes * 4 );
+        }
+      }
+    }
+
+    for( size_t c = 0; c < chains.size(); )
+    {
+      if( chains[c].first == id || chains[c].second == id )
+      {
+        chains[c] = chains.back();
+        chains.pop_back();
+      }
+      else
+      {
+        ++c;
+      }
+    }
+
+    s.index = ~0u;
+    free_ids.push_back( id );
+  }
+
+  //next is played every time id reaches its end, from the moment it did
+  void chain( unsigned id, unsigned next )
+  {
+    chains.push_back( std::make_pair( id, next ) );
+  }
+
+  //starts or resumes the track, after delay seconds of updates
+  void play( unsigned id, float delay = 0 )
+  {
+    if( delay > 0 )
+      add_timer( now + delay, id );
+    else
+      set_playing( id );
+  }
+
+  //stays shown where it is
+  void pause( unsigned id )
+  {
+    if( slots[id].index < groups[slots[id].props].playing )
+      set_shown( id );
+  }
+
+  //back to the start and hidden, waiting starts are dropped
+  void stop( unsigned id )
+  {
+    set_hidden( id );
+    remove_timers( id );
+
+    slot& s = slots[id];
+    group& g = groups[s.props];
+
+    lane( g.time, s.index ) = 0;
+    lane( g.direction, s.index ) = 1;
+    g.info[s.index].repeat_counter = 0;
+  }
+
+  //the curves that call pow or sin (transition::is_expensive) are read
+  //from sampled tables, within about 1e-3 of the functions
+  void set_easing_tables( bool t )
+  {
+    easing_tables = t;
+  }
+
+  //advances the playing tracks and draws every shown one, dt is the time
+  //since the last update
+  void update( float dt )
+  {
+    frame_dt = dt;
+    ended.clear();
+
+    for( unsigned p = 0; p < ( 1u << NUM_PROPS ); ++p )
+    {
+      if( groups[p].playing )
+        advance( groups[p], dt );
+    }
+
+    //starts due by the end of this update, already as far in as they'd be
+    double frame_end = now + dt;
+
+    while( !timers.empty() && timers.front().first <= frame_end )
+    {
+      timer t = timers.front();
+      std::pop_heap( timers.begin(), timers.end(), std::greater<timer>() );
+      timers.pop_back();
+
+      slot& s = slots[t.second];
+      group& g = groups[s.props];
+      float& time = lane( g.time, s.index );
+      float& dir = lane( g.direction, s.index );
+
+      //a chained track that was already playing starts over
+      time = std::min( float( frame_end - t.first ), lane( g.duration, s.index ) );
+      dir = 1;
+      g.info[s.index].repeat_counter = 0;
+      set_playing( t.second );
+    }
+
+    for( unsigned p = 0; p < ( 1u << NUM_PROPS ); ++p )
+    {
+      group& g = groups[p];
+
+      if( g.playing )
+        evaluate( g, p );
+
+      for( size_t i = g.playing; i < g.shown; ++i )
+        font::get().add_to_render_list( *g.info[i].block );
+    }
+
+    //drawn at their end above, from now on they're only shown,
+    //unless a timer started them again
+    for( auto& id : ended )
+    {
+      slot& s = slots[id];
+
+      if( lane( groups[s.props].speed, s.index ) == 0 )
+        set_shown( id );
+    }
+
+    now = frame_end;
+  }
+
+  animation_batch() : easing_tables( false ), now( 0 ), frame_dt( 0 )
+  {
+    for( auto& g : groups )
+      g.count = g.playing = g.shown = 0;
+  }
+
+  ~animation_batch()
+  {
+    for( auto& g : groups )
+    {
+      for( auto& i : g.info )
+        delete i.block;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,166 @@
+#ifndef atlas_allocator_h
+#define atlas_allocator_h
+
+#include <vector>
+#include <cstddef>
+
+//guillotine rectangle packer for the font atlas
+//keeps a list of free rectangles, allocations split a free rectangle in two,
+//released rectangles are merged back with their free neighbours,
+//so single glyphs can be evicted without resetting the whole atlas
+class atlas_allocator
+{
+public:
+  struct rect
+  {
+    unsigned x, y, w, h;
+  };
+private:
+  std::vector<rect> free_rects;
+  unsigned width, height;
+  size_t used_area;
+
+  //put a rect back into the free list, merging it with
+  //every free rect that shares a full edge with it
+  void add_free_rect( rect r )
+  {
+    bool merged = true;
+
+    while( merged )
+    {
+      merged = false;
+
+      for( size_t c = 0; c < free_rects.size(); ++c )
+      {
+        const rect& f = free_rects[c];
+
+        if( f.x == r.x && f.w == r.w && ( f.y + f.h == r.y || r.y + r.h == f.y ) )
+        {
+          r.y = f.y < r.y ? f.y : r.y;
+          r.h += f.h;
+          merged = true;
+        }
+        else if( f.y == r.y && f.h == r.h && ( f.x + f.w == r.x || r.x + r.w == f.x ) )
+        {
+          r.x = f.x < r.x ? f.x : r.x;
+          r.w += f.w;
+          merged = true;
+        }
+
+        if( merged )
+        {
+          free_rects[c] = free_rects.back();
+          free_rects.pop_back();
+          break;
+        }
+      }
+    }
+
+    free_rects.push_back( r );
+  }
+protected:
+public:
+  void reset( unsigned w, unsigned h )
+  {
+    width = w;
+    height = h;
+    used_area = 0;
+    free_rects.clear();
+
+    rect r = { 0, 0, w, h };
+    free_rects.push_back( r );
+  }
+
+  //the atlas grows downwards, the new strip becomes free space
+  void grow( unsigned new_height )
+  {
+    if( new_height <= height )
+      return;
+
+    rect r = { 0, height, width, new_height - height };
+    height = new_height;
+    add_free_rect( r );
+  }
+
+  bool allocate( unsigned w, unsigned h, rect& r )
+  {
+    //best area fit
+    size_t best = free_rects.size();
+    size_t best_waste = size_t( -1 );
+
+    for( size_t c = 0; c < free_rects.size(); ++c )
+    {
+      const rect& f = free_rects[c];
+
+      if( f.w >= w && f.h >= h )
+      {
+        size_t waste = size_t( f.w ) * f.h - size_t( w ) * h;
+
+        if( waste < best_waste )
+        {
+          best = c;
+          best_waste = waste;
+        }
+      }
+    }
+
+    if( best == free_rects.size() )
+      return false;
+
+    rect f = free_rects[best];
+    free_rects[best] = free_rects.back();
+    free_rects.pop_back();
+
+    r.x = f.x;
+    r.y = f.y;
+    r.w = w;
+    r.h = h;
+
+    //split along the shorter leftover axis
+    rect right, top;
+
+    if( f.w - w < f.h - h )
+    {
+      right.x = f.x + w; right.y = f.y; right.w = f.w - w; right.h = h;
+      top.x = f.x; top.y = f.y + h; top.w = f.w; top.h = f.h - h;
+    }
+    else
+    {
+      right.x = f.x + w; right.y = f.y; right.w = f.w - w; right.h = f.h;
+      top.x = f.x; top.y = f.y + h; top.w = w; top.h = f.h - h;
+    }
+
+    if( right.w > 0 && right.h > 0 )
+      free_rects.push_back( right );
+
+    if( top.w > 0 && top.h > 0 )
+      free_rects.push_back( top );
+
+    used_area += size_t( w ) * h;
+
+    return true;
+  }
+
+  void release( const rect& r )
+  {
+    if( r.w == 0 || r.h == 0 )
+      return;
+
+    used_area -= size_t( r.w ) * r.h;
+    add_free_rect( r );
+  }
+
+  float fill_ratio() const
+  {
+    if( width == 0 || height == 0 )
+      return 0;
+
+    return float( used_area ) / ( float( width ) * float( height ) );
+  }
+
+  atlas_allocator() : width( 0 ), height( 0 ), used_area( 0 )
+  {
+  }
+};
+
+#endif
@@ -0,0 +1,89 @@
+//lookups per second of glyph_table against the nested maps it replaced
+//the old has_glyph found missing glyphs by catching the exception of at()
+
+#include "glyph_table.h"
+
+#include <map>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+
+struct bench_glyph
+{
+  float advance;
+  unsigned cache_index;
+};
+
+typedef std::map<unsigned, std::map<uint32_t, bench_glyph> > nested_maps;
+
+static bool map_has_glyph( nested_maps& m, unsigned size, uint32_t c )
+{
+  try
+  {
+    m.at( size ).at( c );
+    return true;
+  }
+  catch( const std::out_of_range& )
+  {
+    return false;
+  }
+}
+
+static double seconds_since( std::chrono::high_resolution_clock::time_point t )
+{
+  return std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - t ).count();
+}
+
+int main()
+{
+  //a few sizes of the latin range, as animated sizes leave behind
+  const unsigned sizes[] = { 12, 16, 20, 24, 32, 48 };
+  const unsigned num_sizes = sizeof( sizes ) / sizeof( sizes[0] );
+  const uint32_t num_codepoints = 256;
+  const unsigned rounds = 2000;
+
+  glyph_table<bench_glyph> table;
+  nested_maps maps;
+
+  for( unsigned s = 0; s < num_sizes; ++s )
+  {
+    for( uint32_t c = 32; c < num_codepoints; ++c )
+    {
+      bench_glyph g = { float( c ), c };
+      table.insert( sizes[s], c ) = g;
+      maps[sizes[s]][c] = g;
+    }
+  }
+
+  //every size once with the whole range, the first 32 codepoints miss
+  size_t lookups = size_t( rounds ) * num_sizes * num_codepoints;
+  unsigned found = 0;
+
+  auto t = std::chrono::high_resolution_clock::now();
+
+  for( unsigned r = 0; r < rounds; ++r )
+    for( unsigned s = 0; s < num_sizes; ++s )
+      for( uint32_t c = 0; c < num_codepoints; ++c )
+        found += table.find( sizes[s], c ) != 0;
+
+  double table_time = seconds_since( t );
+
+  //the misses throw, so the maps get fewer rounds
+  unsigned map_rounds = rounds / 20;
+  size_t map_lookups = size_t( map_rounds ) * num_sizes * num_codepoints;
+
+  t = std::chrono::high_resolution_clock::now();
+
+  for( unsigned r = 0; r < map_rounds; ++r )
+    for( unsigned s = 0; s < num_sizes; ++s )
+      for( uint32_t c = 0; c < num_codepoints; ++c )
+        found += map_has_glyph( maps, sizes[s], c );
+
+  double map_time = seconds_since( t );
+
+  std::cout << "glyph_table: " << lookups / table_time * 1e-6 << " M lookups/s" << std::endl;
+  std::cout << "nested maps: " << map_lookups / map_time * 1e-6 << " M lookups/s" << std::endl;
+  std::cout << "(" << found << " hits)" << std::endl;
+
+  return 0;
+}
@@ -0,0 +1,107 @@
+//ns per query of hit_cells::find and of a hit_grid lookup followed by
+//the find of the block under the point, as font::hit_test does it
+
+#include "hit_cells.h"
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+static double seconds_since( std::chrono::high_resolution_clock::time_point t )
+{
+  return std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - t ).count();
+}
+
+struct bench_block
+{
+  hit_cells hits;
+  mm::vec4 rect; //min xy, max xy in pixels
+};
+
+//lines of 8 pixel wide cells from the top of the box down, 20 pixel lines
+static void fill( hit_cells& h, float x, float top, unsigned lines, unsigned per_line )
+{
+  h.clear();
+
+  for( unsigned l = 0; l < lines; ++l )
+  {
+    float y1 = top - 20.0f * l;
+    h.add_line( y1 - 20.0f, y1 );
+
+    for( unsigned c = 0; c < per_line; ++c )
+      h.add_cell( x + 8.0f * c, x + 8.0f * ( c + 1 ), l * per_line + c );
+  }
+}
+
+int main()
+{
+  const unsigned queries = 1 << 20;
+  const mm::uvec2 screen( 1920, 1080 );
+
+  std::mt19937 rng( 1 );
+  std::uniform_real_distribution<float> rx( 0, float( screen.x ) ), ry( 0, float( screen.y ) );
+  std::vector<mm::vec2> points( queries );
+
+  for( auto& p : points )
+    p = mm::vec2( rx( rng ), ry( rng ) );
+
+  //one text of 50k cells, 500 lines of 100 characters
+  hit_cells big;
+  fill( big, 0, 10000.0f, 500, 100 );
+
+  //its lines are 20 pixels and 800 wide, spread the queries over it
+  std::uniform_real_distribution<float> bx( 0, 800.0f ), by( 0, 10000.0f );
+  std::vector<mm::vec2> big_points( queries );
+
+  for( auto& p : big_points )
+    p = mm::vec2( bx( rng ), by( rng ) );
+
+  unsigned found = 0;
+  auto t = std::chrono::high_resolution_clock::now();
+
+  for( auto& p : big_points )
+    found += big.find( p ) != ~0u;
+
+  double find_time = seconds_since( t );
+
+  //2000 blocks of 25 cells, 50k cells over the screen, overlapping
+  const unsigned num_blocks = 2000;
+  std::vector<bench_block> blocks( num_blocks );
+
+  for( unsigned i = 0; i < num_blocks; ++i )
+  {
+    float x = rx( rng ) * 0.9f, y = 40.0f + ry( rng ) * 0.95f;
+    fill( blocks[i].hits, x, y, 1, 25 );
+    blocks[i].rect = mm::vec4( x, y - 20.0f, x + 200.0f, y );
+  }
+
+  hit_grid grid;
+
+  t = std::chrono::high_resolution_clock::now();
+  grid.build( screen, 32, blocks );
+  double build_time = seconds_since( t );
+
+  t = std::chrono::high_resolution_clock::now();
+
+  for( auto& p : points )
+  {
+    found += grid.visit( p, [&]( unsigned i )
+    {
+      const bench_block& b = blocks[i];
+
+      if( p.x < b.rect.x || p.y < b.rect.y || p.x >= b.rect.z || p.y >= b.rect.w )
+        return false;
+
+      return b.hits.find( p ) != ~0u;
+    } );
+  }
+
+  double grid_time = seconds_since( t );
+
+  std::cout << "hit_cells::find, 50000 cells: " << find_time / queries * 1e9 << " ns/query" << std::endl;
+  std::cout << "hit_grid over " << num_blocks << " blocks, 50000 cells: " << grid_time / queries * 1e9 << " ns/query, "
+            << build_time * 1e6 << " us to build" << std::endl;
+  std::cout << "(" << found << " hits)" << std::endl;
+
+  return 0;
+}
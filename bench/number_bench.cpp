@@ -0,0 +1,94 @@
+//ms per frame of 1000 hud counters that change every frame
+//text_block::set_number against formatting the text and set_text
+//needs a gl 4.3 context, run it from a directory next to shaders/ and resources/
+
+#include "framework.h"
+#include "font.h"
+
+#include <chrono>
+#include <iostream>
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double ms_between( bench_clock::time_point a, bench_clock::time_point b )
+{
+  return std::chrono::duration<double, std::milli>( b - a ).count();
+}
+
+int main()
+{
+  uvec2 res( 1280, 720 );
+  prototyper::framework frm;
+
+  frm.init( res, "number_bench" );
+  frm.set_vsync( false );
+
+  frm.load_shader( font::get().get_shader(), GL_VERTEX_SHADER, "../shaders/font/font.vs" );
+  frm.load_shader( font::get().get_shader(), GL_FRAGMENT_SHADER, "../shaders/font/font.ps" );
+
+  font_inst font_instance;
+  font::get().resize( res );
+  font::get().load_font( "../resources/font.ttf", font_instance, 20 );
+
+  //a grid of counters over the screen
+  const unsigned columns = 25, rows = 40, warmup = 20, frames = 500;
+  const unsigned counters = columns * rows;
+
+  std::vector<text_block> blocks( counters );
+
+  for( unsigned i = 0; i < counters; ++i )
+  {
+    blocks[i].set_font( font_instance, 20 );
+    blocks[i].set_transform( create_translation( vec3( 50.0f * ( i % columns ), -18.0f * ( i / columns ), 0 ) ) );
+  }
+
+  //0 formats with set_number, 1 with std::to_wstring and set_text
+  for( int pass = 0; pass < 2; ++pass )
+  {
+    double update_ms = 0, frame_ms = 0;
+
+    for( unsigned f = 0; f < warmup + frames; ++f )
+    {
+      glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+      auto t0 = bench_clock::now();
+
+      //every value changes every frame, so every block is laid out again
+      for( unsigned i = 0; i < counters; ++i )
+      {
+        long long v = ( long long )f * 7919 + i * 104729;
+
+        if( pass == 0 )
+          blocks[i].set_number( v );
+        else
+          blocks[i].set_text( std::to_wstring( v ) );
+
+        font::get().add_to_render_list( blocks[i] );
+      }
+
+      auto t1 = bench_clock::now();
+
+      font::get().render();
+      glFinish();
+
+      auto t2 = bench_clock::now();
+
+      frm.force_display();
+
+      if( f >= warmup )
+      {
+        update_ms += ms_between( t0, t1 );
+        frame_ms += ms_between( t0, t2 );
+      }
+    }
+
+    std::cout << ( pass == 0 ? "set_number: " : "set_text: " ) << counters << " counters a frame, "
+              << update_ms / frames << " ms/frame formatting and layout, "
+              << frame_ms / frames << " ms/frame with drawing" << std::endl;
+  }
+
+  blocks.clear();
+  font::get().destroy();
+
+  return 0;
+}
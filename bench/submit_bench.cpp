@@ -0,0 +1,79 @@
+//glyphs per millisecond through font::add_to_render_list and font::render
+//only uses the api that predates the instance stream, so the same file
+//builds against older trees for a before/after comparison
+//needs a gl 4.3 context, run it from a directory next to shaders/ and resources/
+
+#include "framework.h"
+#include "font.h"
+
+#include <chrono>
+#include <iostream>
+
+typedef std::chrono::high_resolution_clock bench_clock;
+
+static double ms_between( bench_clock::time_point a, bench_clock::time_point b )
+{
+  return std::chrono::duration<double, std::milli>( b - a ).count();
+}
+
+int main()
+{
+  uvec2 res( 1280, 720 );
+  prototyper::framework frm;
+
+  frm.init( res, "submit_bench" );
+  frm.set_vsync( false );
+
+  frm.load_shader( font::get().get_shader(), GL_VERTEX_SHADER, "../shaders/font/font.vs" );
+  frm.load_shader( font::get().get_shader(), GL_FRAGMENT_SHADER, "../shaders/font/font.ps" );
+
+  font_inst font_instance;
+  font::get().resize( res );
+  font::get().load_font( "../resources/font.ttf", font_instance, 20 );
+
+  //a screen full of 80 character lines
+  std::wstring line = L"The quick brown fox jumps over the lazy dog, 0123456789 times a frame! ABCDEFGHIJ";
+  const unsigned lines = 36, warmup = 20, frames = 500;
+
+  unsigned glyphs_per_line = 0;
+
+  for( auto c : line )
+    glyphs_per_line += c != L' ';
+
+  double submit_ms = 0, frame_ms = 0;
+
+  for( unsigned f = 0; f < warmup + frames; ++f )
+  {
+    glClear( GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT );
+
+    auto t0 = bench_clock::now();
+
+    for( unsigned l = 0; l < lines; ++l )
+      font::get().add_to_render_list( line, font_instance, vec4( 1 ), create_translation( vec3( 0, -20.0f * l, 0 ) ) );
+
+    auto t1 = bench_clock::now();
+
+    font::get().render();
+    glFinish();
+
+    auto t2 = bench_clock::now();
+
+    frm.force_display();
+
+    if( f >= warmup )
+    {
+      submit_ms += ms_between( t0, t1 );
+      frame_ms += ms_between( t0, t2 );
+    }
+  }
+
+  double glyphs = double( glyphs_per_line ) * lines * frames;
+
+  std::cout << glyphs_per_line * lines << " glyphs a frame, " << frames << " frames" << std::endl;
+  std::cout << "submitted: " << glyphs / submit_ms << " glyphs/ms" << std::endl;
+  std::cout << "submitted and drawn: " << glyphs / frame_ms << " glyphs/ms, " << frame_ms / frames << " ms/frame" << std::endl;
+
+  font::get().destroy();
+
+  return 0;
+}
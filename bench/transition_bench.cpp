@@ -0,0 +1,84 @@
+//ns per evaluation of every easing: the scalar function, ease4 and ease_table
+
+#include "transition.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+static double seconds_since( std::chrono::high_resolution_clock::time_point t )
+{
+  return std::chrono::duration<double>( std::chrono::high_resolution_clock::now() - t ).count();
+}
+
+int main()
+{
+  //about one text effect's worth of characters, evaluated many times
+  const unsigned count = 4096, rounds = 500;
+  const double evaluations = double( count ) * rounds;
+
+  std::vector<float> x( count ), y( count );
+
+  for( unsigned i = 0; i < count; ++i )
+    x[i] = ( i * 2654435761u % count ) / float( count - 1 );
+
+  //results go to y, a sum would make every evaluation wait for the last
+  float sink = 0;
+
+  std::cout << "easing: scalar, ease4, ease_table ns/evaluation" << std::endl;
+
+  for( unsigned e = 0; e < transition::NUM_EASINGS; ++e )
+  {
+    transition::func f = transition::get( e );
+
+    auto t = std::chrono::high_resolution_clock::now();
+
+    for( unsigned r = 0; r < rounds; ++r )
+    {
+      for( unsigned i = 0; i < count; ++i )
+        y[i] = f( x[i] );
+
+      sink += y[r % count];
+    }
+
+    double scalar_time = seconds_since( t );
+
+    t = std::chrono::high_resolution_clock::now();
+
+    for( unsigned r = 0; r < rounds; ++r )
+    {
+      for( unsigned i = 0; i < count; i += 4 )
+      {
+        mm::vec4 v = transition::ease4( e, mm::vec4( x[i], x[i + 1], x[i + 2], x[i + 3] ) );
+        y[i] = v.x;
+        y[i + 1] = v.y;
+        y[i + 2] = v.z;
+        y[i + 3] = v.w;
+      }
+
+      sink += y[r % count];
+    }
+
+    double vec4_time = seconds_since( t );
+
+    t = std::chrono::high_resolution_clock::now();
+
+    for( unsigned r = 0; r < rounds; ++r )
+    {
+      for( unsigned i = 0; i < count; ++i )
+        y[i] = transition::ease_table( e, x[i] );
+
+      sink += y[r % count];
+    }
+
+    double table_time = seconds_since( t );
+
+    std::cout << e << ": " << scalar_time / evaluations * 1e9 << ", "
+              << vec4_time / evaluations * 1e9 << ", "
+              << table_time / evaluations * 1e9 << std::endl;
+  }
+
+  std::cout << "(" << sink << ")" << std::endl;
+
+  return 0;
+}
@@ -1,25 +1,104 @@
 #include "font.h"
 
 #include <fstream>
+#include <cstddef>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <sstream>
+#include <cfloat>
+
+#include "mapped_file.h"
 
 #include "ft2build.h"
 #include FT_FREETYPE_H
+#include FT_SIZES_H
 
 #define MAX_TEX_SIZE 8192
 #define MIN_TEX_SIZE 128
 
 #define FONT_VERTEX 0
 #define FONT_TEXCOORD 1
-#define FONT_VERTSCALEBIAS 2
-#define FONT_TEXSCALEBIAS 3
-#define FONT_COLOR 4
-#define FONT_FACE 5
-#define FONT_TRANSFORM 6
-#define FONT_FILTER 7
-
-wchar_t buf[2] = { -1, L'\0' };
+#define FONT_FACE 2
+
+//instance attribute locations
+#define FONT_INSTANCE_POS 2
+#define FONT_INSTANCE_SIZE 3
+#define FONT_INSTANCE_GLYPH 4
+#define FONT_INSTANCE_BATCH 5
+
+//shader storage bindings
+#define FONT_BATCH_BINDING 1
+#define FONT_GLYPH_BINDING 2
+
+//sdf glyphs are rasterized once at this size and scaled in the shaders
+#define FONT_SDF_SIZE 48
+//distance range in texels around the outline, at FONT_SDF_SIZE
+#define FONT_SDF_SPREAD 6
+#define FONT_MAX_SDF_STYLES 16
+#define FONT_MAX_TEXT_EFFECTS 16
+
+//initial glyph instances per frame, the stream grows if a frame needs more
+#define FONT_STREAM_SIZE 4096
+#define FONT_BATCH_STREAM_SIZE 256
+
+//initial capacity of the text_block buffers, they grow on demand
+#define FONT_RETAINED_SIZE 4096
+#define FONT_RETAINED_BATCH_SIZE 64
+
+//freetype worker threads, at most one less than the cores
+#define FONT_MAX_RASTER_THREADS 4
+
+//default memory for the paragraph textures of cached text_blocks
+#define FONT_PARAGRAPH_BUDGET ( 32 << 20 )
+
+//codepoint of the solid glyph the decorations stretch, a noncharacter
+//that fits a 16 bit wchar_t, so it's the same on every platform
+static const uint32_t FONT_WHITE_GLYPH = 0xFFFF;
+
+wchar_t buf[2] = { wchar_t( FONT_WHITE_GLYPH ), L'\0' };
 std::wstring cachestring = std::wstring( buf ) + L" 0123456789a�bcde�fghi�jklmno���pqrstu���vwxyzA�BCDE�FGHI�JKLMNO���PQRSTU���VWXYZ+!%/=()|$[]<>#&@{},.~-?:_;*`^'\"";
 
+//kerning of one glyph size, built once when the size is first set
+//pairs within the cachestring are looked up in a dense table,
+//everything else is asked from freetype once and then hashed
+struct kerning_cache
+{
+  unsigned int size;
+  std::vector<float> dense; //cachestring.size() ^ 2, empty if the face has no kerning
+  glyph_table<float> pairs; //keyed by (prev, next) codepoints
+};
+
+//the glyphs text_block::set_number uses, looked up once per glyph size
+//the pointers stay valid until a glyph enters or leaves the atlas
+#define FONT_DIGITS "0123456789-."
+#define FONT_NUM_DIGITS 12
+
+struct digit_table
+{
+  unsigned int size; //glyph size
+  unsigned arrivals, evictions; //of the library when it was built
+  glyph* glyphs[FONT_NUM_DIGITS]; //0 if not in the atlas yet
+};
+
+//codepoint -> position in cachestring
+static unsigned int cachestring_index( uint32_t c )
+{
+  static glyph_table<unsigned int>* indices = 0;
+
+  if( !indices )
+  {
+    indices = new glyph_table<unsigned int>();
+
+    for( size_t i = 0; i < cachestring.size(); ++i )
+      indices->insert( 0, (uint32_t)cachestring[i] ) = i;
+  }
+
+  unsigned int* i = indices->find( 0, c );
+  return i ? *i : ~0u;
+}
+
 struct glyph
 {
   float offset_x;
@@ -28,12 +107,511 @@ struct glyph
   float h;
   float texcoords[4];
   FT_Glyph_Metrics metrics;
-  FT_Vector advance;
+  float advance; //horizontal, in pixels at the glyph size
   FT_UInt glyphid;
   unsigned int cache_index;
+  unsigned int kerning_index; //position in cachestring, or ~0u
+  atlas_allocator::rect atlas_rect;
+  unsigned int last_used; //frame
+  bool pinned; //never evicted
+};
+
+static FT_Face open_face( FT_Library lib, const unsigned char* data, size_t size, unsigned int index )
+{
+  FT_Face f;
+
+  if( FT_New_Memory_Face( lib, data, (FT_Long)size, index, &f ) )
+    return 0;
+
+  //64x horizontal resolution scaled back by the transform,
+  //keeps the advances precise
+  FT_Matrix matrix = { (int)( ( 1.0 / 64.0f ) * 0x10000L ),
+                       (int)( ( 0.0 ) * 0x10000L ),
+                       (int)( ( 0.0 ) * 0x10000L ),
+                       (int)( ( 1.0 ) * 0x10000L ) };
+
+  FT_Select_Charmap( f, FT_ENCODING_UNICODE );
+  FT_Set_Transform( f, &matrix, NULL );
+
+  return f;
+}
+
+static void set_glyph_size( FT_Face f, unsigned int size )
+{
+  FT_Set_Char_Size( f, size * 64.0f, 0.0f, 72 * 64.0f, 72 );
+}
+
+//one memory mapped font file and its FT_Face, shared by every font_inst
+//that loads the same file, each char size gets its own FT_Size, so
+//font_insts at different sizes don't reset each other's scaling
+struct shared_face
+{
+  std::string filename;
+  unsigned int index;
+  mapped_file file;
+  uint64_t file_hash; //keys the baked atlas cache
+  FT_Face face;
+  std::map<FT_F26Dot6, FT_Size> sizes; //by char width
+  unsigned refs;
+};
+
+static void activate_size( shared_face* sf, FT_F26Dot6 char_width )
+{
+  auto it = sf->sizes.find( char_width );
+
+  if( it != sf->sizes.end() )
+  {
+    FT_Activate_Size( it->second );
+    return;
+  }
+
+  FT_Size s;
+  FT_New_Size( sf->face, &s );
+  FT_Activate_Size( s );
+  FT_Set_Char_Size( sf->face, char_width, 0, 72 * 64, 72 );
+  sf->sizes[char_width] = s;
+}
+
+//kerning of every cachestring pair at the current size of f,
+//left empty if the face has no kerning
+static void compute_dense_kerning( FT_Face f, std::vector<float>& dense )
+{
+  if( !FT_HAS_KERNING( f ) )
+    return;
+
+  size_t n = cachestring.size();
+  std::vector<FT_UInt> ids( n );
+
+  for( size_t i = 0; i < n; ++i )
+    ids[i] = FT_Get_Char_Index( f, (FT_ULong)cachestring[i] );
+
+  dense.resize( n * n );
+
+  for( size_t i = 0; i < n; ++i )
+  {
+    for( size_t j = 0; j < n; ++j )
+    {
+      FT_Vector kern;
+      FT_Get_Kerning( f, ids[i], ids[j], FT_KERNING_UNFITTED, &kern );
+      dense[i * n + j] = kern.x / ( 64.0f*64.0f );
+    }
+  }
+}
+
+//8 point sequential euclidean distance transform
+struct sdf_point
+{
+  int dx, dy;
+
+  int dist2() const
+  {
+    return dx * dx + dy * dy;
+  }
+};
+
+static void sdf_compare( std::vector<sdf_point>& g, int w, int h, sdf_point& p, int x, int y, int ox, int oy )
+{
+  x += ox;
+  y += oy;
+
+  if( x < 0 || y < 0 || x >= w || y >= h )
+    return;
+
+  sdf_point o = g[x + y * w];
+  o.dx += ox;
+  o.dy += oy;
+
+  if( o.dist2() < p.dist2() )
+    p = o;
+}
+
+static void sdf_sweep( std::vector<sdf_point>& g, int w, int h )
+{
+  for( int y = 0; y < h; ++y )
+  {
+    for( int x = 0; x < w; ++x )
+    {
+      sdf_point p = g[x + y * w];
+      sdf_compare( g, w, h, p, x, y, -1, 0 );
+      sdf_compare( g, w, h, p, x, y, 0, -1 );
+      sdf_compare( g, w, h, p, x, y, -1, -1 );
+      sdf_compare( g, w, h, p, x, y, 1, -1 );
+      g[x + y * w] = p;
+    }
+
+    for( int x = w - 1; x >= 0; --x )
+    {
+      sdf_point p = g[x + y * w];
+      sdf_compare( g, w, h, p, x, y, 1, 0 );
+      g[x + y * w] = p;
+    }
+  }
+
+  for( int y = h - 1; y >= 0; --y )
+  {
+    for( int x = w - 1; x >= 0; --x )
+    {
+      sdf_point p = g[x + y * w];
+      sdf_compare( g, w, h, p, x, y, 1, 0 );
+      sdf_compare( g, w, h, p, x, y, 0, 1 );
+      sdf_compare( g, w, h, p, x, y, -1, 1 );
+      sdf_compare( g, w, h, p, x, y, 1, 1 );
+      g[x + y * w] = p;
+    }
+
+    for( int x = 0; x < w; ++x )
+    {
+      sdf_point p = g[x + y * w];
+      sdf_compare( g, w, h, p, x, y, -1, 0 );
+      g[x + y * w] = p;
+    }
+  }
+}
+
+//turns a coverage bitmap into a signed distance field with 'spread' texels
+//of extra border on each side, 0.5 (128) is the outline, inside is brighter
+static void make_distance_field( const unsigned char* src, int w, int h, int pitch, int spread, std::vector<unsigned char>& dst )
+{
+  int dw = w + 2 * spread;
+  int dh = h + 2 * spread;
+
+  sdf_point seed = { 0, 0 }, far_away = { 9999, 9999 };
+  std::vector<sdf_point> to_inside( dw * dh, far_away ), to_outside( dw * dh, seed );
+
+  for( int y = 0; y < h; ++y )
+  {
+    for( int x = 0; x < w; ++x )
+    {
+      if( src[x + y * pitch] > 127 )
+      {
+        int i = ( x + spread ) + ( y + spread ) * dw;
+        to_inside[i] = seed;
+        to_outside[i] = far_away;
+      }
+    }
+  }
+
+  sdf_sweep( to_inside, dw, dh );
+  sdf_sweep( to_outside, dw, dh );
+
+  dst.resize( dw * dh );
+
+  for( int c = 0; c < dw * dh; ++c )
+  {
+    float dist = std::sqrt( (float)to_outside[c].dist2() ) - std::sqrt( (float)to_inside[c].dist2() );
+    float val = 127.5f + dist * ( 127.5f / spread );
+    dst[c] = (unsigned char)std::max( 0.0f, std::min( 255.0f, val ) );
+  }
+}
+
+//a glyph bitmap coming back from a rasterizer thread, flipped and
+//padded with the 1 texel empty border every atlas entry gets, so
+//filtering never picks up the neighbours
+struct rasterized_glyph
+{
+  font_inst* owner;
+  unsigned int size; //glyph size
+  uint32_t codepoint;
+  bool ok;
+  int width, rows; //without the border
+  int left, top;
+  float advance;
+  FT_UInt glyphid;
+  std::vector<unsigned char> pixels; //( width + 2 ) * ( rows + 2 )
+};
+
+struct rasterize_job
+{
+  font_inst* owner;
+  const shared_face* font_file; //the mapped file is read by every thread
+  unsigned int size;
+  uint32_t codepoint;
+  bool sdf;
+};
+
+//runs on a rasterizer thread, only touches its own freetype face
+static void rasterize( FT_Face f, bool sdf, rasterized_glyph& r )
+{
+  //hinting snaps to the pixel grid of one size, which an sdf can't use
+  FT_Error error = FT_Load_Char( f, (const FT_UInt)r.codepoint, sdf ? FT_LOAD_RENDER | FT_LOAD_NO_HINTING : FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT );
+
+  r.ok = !error;
+  r.width = 0;
+  r.rows = 0;
+  r.left = 0;
+  r.top = 0;
+  r.advance = 0;
+  r.glyphid = FT_Get_Char_Index( f, (const FT_ULong)r.codepoint );
+
+  if( error )
+  {
+    r.pixels.assign( 2 * 2, 0 );
+    return;
+  }
+
+  FT_GlyphSlot theglyph = f->glyph;
+  FT_Bitmap* bitmap = &theglyph->bitmap;
+
+  const unsigned char* pixels = bitmap->buffer;
+  int pitch = bitmap->pitch;
+  int width = bitmap->width;
+  int rows = bitmap->rows;
+  int left = theglyph->bitmap_left;
+  int top = theglyph->bitmap_top;
+  std::vector<unsigned char> distance_field;
+
+  if( sdf )
+  {
+    make_distance_field( bitmap->buffer, bitmap->width, bitmap->rows, bitmap->pitch, FONT_SDF_SPREAD, distance_field );
+    pixels = &distance_field[0];
+    width += 2 * FONT_SDF_SPREAD;
+    rows += 2 * FONT_SDF_SPREAD;
+    pitch = width;
+    left -= FONT_SDF_SPREAD;
+    top += FONT_SDF_SPREAD;
+  }
+
+  int w = width + 2;
+  r.pixels.assign( w * ( rows + 2 ), 0 );
+
+  for( int y = 0; y < rows; y++ )
+  {
+    for( int x = 0; x < width; x++ )
+    {
+      r.pixels[( x + 1 ) + ( rows - y ) * w] = pixels[x + y * pitch];
+    }
+  }
+
+  r.width = width;
+  r.rows = rows;
+  r.left = left;
+  r.top = top;
+  r.advance = theglyph->advance.x / 64.0f;
+}
+
+//solid 4x4 quad, stretched for the text decorations
+static void make_white_glyph( rasterized_glyph& r )
+{
+  r.codepoint = FONT_WHITE_GLYPH;
+  r.ok = true;
+  r.width = 4;
+  r.rows = 4;
+  r.left = 0;
+  r.top = 0;
+  r.advance = 0;
+  r.glyphid = 0;
+  r.pixels.assign( 6 * 6, 0 );
+
+  for( int y = 1; y < 5; ++y )
+    for( int x = 1; x < 5; ++x )
+      r.pixels[x + y * 6] = 255;
+}
+
+//pool of freetype worker threads, every thread has its own FT_Library
+//and opens its own FT_Face per font, as freetype objects can't be shared
+//between threads, finished glyphs are collected by the render thread
+class glyph_rasterizer
+{
+private:
+  std::vector<std::thread> workers;
+  std::mutex m;
+  std::condition_variable job_ready, job_done;
+  std::deque<rasterize_job> jobs;
+  std::vector<rasterized_glyph> results;
+  unsigned in_flight; //queued or being rasterized
+  bool quit;
+  const shared_face* dropped;
+  unsigned drop_generation;
+  unsigned drop_acks;
+
+  void work()
+  {
+    struct worker_face
+    {
+      FT_Face f;
+      unsigned int size;
+    };
+
+    FT_Library lib = 0;
+
+    if( FT_Init_FreeType( &lib ) )
+    {
+      std::cerr << "Error initializing the freetype library." << std::endl;
+      lib = 0;
+    }
+
+    std::map<const shared_face*, worker_face> faces;
+    unsigned seen_drop = 0;
+
+    for( ;; )
+    {
+      rasterize_job j;
+      const shared_face* drop = 0;
+
+      {
+        std::unique_lock<std::mutex> lock( m );
+        job_ready.wait( lock, [&]
+        {
+          return quit || !jobs.empty() || seen_drop != drop_generation;
+        } );
+
+        if( quit )
+          break;
+
+        if( seen_drop != drop_generation )
+        {
+          seen_drop = drop_generation;
+          drop = dropped;
+        }
+        else
+        {
+          j = jobs.front();
+          jobs.pop_front();
+        }
+      }
+
+      if( drop )
+      {
+        auto it = faces.find( drop );
+
+        if( it != faces.end() )
+        {
+          if( it->second.f )
+            FT_Done_Face( it->second.f );
+
+          faces.erase( it );
+        }
+
+        {
+          std::lock_guard<std::mutex> lock( m );
+          ++drop_acks;
+        }
+
+        job_done.notify_all();
+        continue;
+      }
+
+      auto it = faces.find( j.font_file );
+
+      if( it == faces.end() )
+      {
+        const mapped_file& file = j.font_file->file;
+        worker_face wf = { lib ? open_face( lib, file.get_data(), file.get_size(), j.font_file->index ) : 0, 0 };
+        it = faces.insert( std::make_pair( j.font_file, wf ) ).first;
+      }
+
+      rasterized_glyph r;
+      r.owner = j.owner;
+      r.size = j.size;
+      r.codepoint = j.codepoint;
+
+      if( it->second.f )
+      {
+        if( it->second.size != j.size )
+        {
+          set_glyph_size( it->second.f, j.size );
+          it->second.size = j.size;
+        }
+
+        rasterize( it->second.f, j.sdf, r );
+      }
+      else
+      {
+        r.ok = false;
+        r.width = r.rows = r.left = r.top = 0;
+        r.advance = 0;
+        r.glyphid = 0;
+        r.pixels.assign( 2 * 2, 0 );
+      }
+
+      {
+        std::lock_guard<std::mutex> lock( m );
+        results.push_back( std::move( r ) );
+        --in_flight;
+      }
+
+      job_done.notify_all();
+    }
+
+    for( auto& f : faces )
+    {
+      if( f.second.f )
+        FT_Done_Face( f.second.f );
+    }
+
+    if( lib )
+      FT_Done_FreeType( lib );
+  }
+protected:
+public:
+  void push( const rasterize_job& j )
+  {
+    {
+      std::lock_guard<std::mutex> lock( m );
+      jobs.push_back( j );
+      ++in_flight;
+    }
+
+    job_ready.notify_one();
+  }
+
+  //every thread closes its FT_Face of the font file,
+  //returns once they all did, so the file can be unmapped
+  void drop_face( const shared_face* sf )
+  {
+    std::unique_lock<std::mutex> lock( m );
+
+    dropped = sf;
+    ++drop_generation;
+    drop_acks = 0;
+    job_ready.notify_all();
+
+    job_done.wait( lock, [&]
+    {
+      return drop_acks == workers.size();
+    } );
+  }
+
+  //hands over the finished glyphs, optionally waits for all queued ones
+  void collect( std::vector<rasterized_glyph>& out, bool wait )
+  {
+    std::unique_lock<std::mutex> lock( m );
+
+    if( wait )
+    {
+      job_done.wait( lock, [&]
+      {
+        return in_flight == 0;
+      } );
+    }
+
+    out.swap( results );
+  }
+
+  glyph_rasterizer() : in_flight( 0 ), quit( false ), dropped( 0 ), drop_generation( 0 ), drop_acks( 0 )
+  {
+    unsigned n = std::thread::hardware_concurrency();
+    n = std::max( 1u, std::min( n > 1 ? n - 1 : 1, (unsigned)FONT_MAX_RASTER_THREADS ) );
+
+    for( unsigned c = 0; c < n; ++c )
+      workers.push_back( std::thread( &glyph_rasterizer::work, this ) );
+  }
+
+  ~glyph_rasterizer()
+  {
+    {
+      std::lock_guard<std::mutex> lock( m );
+      quit = true;
+    }
+
+    job_ready.notify_all();
+
+    for( auto& w : workers )
+      w.join();
+  }
 };
 
-library::library() : the_library( 0 ), tex( 0 ), texsampler_point( 0 ), texsampler_linear( 0 ), vao( 0 ), the_shader( 0 ), is_set_up( false )
+library::library() : the_library( 0 ), frame( 1 ), tex( 0 ), texsampler_point( 0 ), texsampler_linear( 0 ), vao( 0 ), stream_generation( 0 ), retained_vao( 0 ), retained_generation( 0 ), indirect_buffer( 0 ), glyph_ssbo( 0 ), glyph_ssbo_size( 0 ), dirty_begin( 0 ), dirty_end( 0 ), style_ubo( 0 ), styles_dirty( true ), effect_ubo( 0 ), effects_dirty( true ), the_shader( 0 ), is_set_up( false ), rasterizer( 0 ), pbo( 0 ), pbo_size( 0 ), glyph_arrivals( 0 ), glyph_evictions( 0 ), cached_shader( 0 ), cache_fbo( 0 ), cache_bytes( 0 ), cache_budget( FONT_PARAGRAPH_BUDGET )
 {
   for( int c = 0; c < FONT_LIB_VBO_SIZE; ++c )
     vbos[c] = 0;
@@ -53,12 +631,42 @@ void library::destroy()
   glDeleteSamplers( 1, &texsampler_linear );
   glDeleteTextures( 1, &tex );
   glDeleteVertexArrays( 1, &vao );
+  glDeleteVertexArrays( 1, &retained_vao );
+  glDeleteBuffers( 1, &indirect_buffer );
   glDeleteBuffers( FONT_LIB_VBO_SIZE, vbos );
+  glDeleteBuffers( 1, &style_ubo );
+  glDeleteBuffers( 1, &effect_ubo );
+  glDeleteBuffers( 1, &glyph_ssbo );
+  glyph_stream.destroy();
+  batch_stream.destroy();
+  retained_instances.destroy();
+  retained_batches.destroy();
+  glDeleteBuffers( 1, &pbo );
   glDeleteProgram( the_shader );
+  glDeleteProgram( cached_shader );
+  glDeleteFramebuffers( 1, &cache_fbo );
+  cache_fbo = 0;
+
+  for( auto& b : cached_blocks )
+  {
+    glDeleteTextures( 1, &b->cache_tex );
+    b->cache_tex = 0;
+    b->cache_valid = false;
+  }
+
+  cached_blocks.clear();
+  cache_bakes.clear();
+  cached_draws.clear();
+  cache_bytes = 0;
+
+  delete rasterizer;
+  rasterizer = 0;
 }
 
 library::~library()
 {
+  delete rasterizer;
+
   if( the_library )
   {
     FT_Error error;
@@ -71,25 +679,94 @@ library::~library()
   }
 }
 
-void library::delete_glyphs()
+void library::evict_glyph( font_inst* f, unsigned size, uint32_t codepoint )
 {
-  texture_pen = mm::uvec2( 1 );
-  texture_row_h = 0;
-  texsize = mm::uvec2( 0 );
+  glyph* g = f->the_face->glyphs->find( size, codepoint );
+
+  if( !g )
+    return;
 
-  font_data.clear();
+  atlas.release( g->atlas_rect );
+  remove_font_data( g->cache_index );
+  f->the_face->glyphs->erase( size, codepoint );
 
-  for( auto& c : instances )
+  ++frame_stats.evictions;
+  ++glyph_evictions;
+}
+
+bool library::allocate_glyph( unsigned w, unsigned h, atlas_allocator::rect& r )
+{
+  if( texsize.x == 0 || texsize.y == 0 )
+  {
+    expand_tex();
+  }
+
+  if( atlas.allocate( w, h, r ) )
+    return true;
+
+  //grow the texture while we can
+  while( expand_tex() )
+  {
+    if( atlas.allocate( w, h, r ) )
+      return true;
+  }
+
+  //then evict the least recently used glyphs one by one
+  //glyphs used this frame are already in the render list, so they stay
+  struct candidate
+  {
+    unsigned last_used;
+    font_inst* f;
+    unsigned size;
+    uint32_t codepoint;
+  };
+
+  std::vector<candidate> candidates;
+
+  for( auto& i : instances )
+  {
+    i->the_face->glyphs->for_each( [&]( unsigned size, uint32_t codepoint, glyph & g )
+    {
+      if( !g.pinned && g.last_used != frame )
+      {
+        candidate cand = { g.last_used, i, size, codepoint };
+        candidates.push_back( cand );
+      }
+    } );
+  }
+
+  auto older = []( const candidate & a, const candidate & b )
+  {
+    return a.last_used < b.last_used;
+  };
+
+  //only the oldest few are put in order, a miss usually frees enough
+  //space with them, the rest is ordered a chunk at a time if not
+  size_t done = 0;
+
+  while( done < candidates.size() )
   {
-    ( *c->the_face->glyphs ).clear();
+    size_t chunk = std::min( candidates.size(), done + std::max( size_t( 16 ), ( candidates.size() - done ) / 8 ) );
+
+    std::nth_element( candidates.begin() + done, candidates.begin() + ( chunk - 1 ), candidates.end(), older );
+    std::sort( candidates.begin() + done, candidates.begin() + chunk, older );
+
+    for( ; done < chunk; ++done )
+    {
+      evict_glyph( candidates[done].f, candidates[done].size, candidates[done].codepoint );
+
+      if( atlas.allocate( w, h, r ) )
+        return true;
+    }
   }
+
+  return false;
 }
 
 void library::set_up()
 {
   if( is_set_up ) return;
 
-  texture_pen = mm::uvec2( 0 );
   texsize = mm::uvec2( 0 );
 
   glGenTextures( 1, &tex );
@@ -146,61 +823,113 @@ void library::set_up()
   texcoords[3 * 2 + 0] = 1;
   texcoords[3 * 2 + 1] = 0;
 
-  glGenVertexArrays( 1, &vao );
-  glBindVertexArray( vao );
-
   glGenBuffers( 1, &vbos[FONT_VERTEX] );
   glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_VERTEX] );
   glBufferData( GL_ARRAY_BUFFER, sizeof(float)* 2 * vertices.size(), &vertices[0], GL_STATIC_DRAW );
-  glEnableVertexAttribArray( FONT_VERTEX );
-  glVertexAttribPointer( FONT_VERTEX, 2, GL_FLOAT, false, 0, 0 );
 
   glGenBuffers( 1, &vbos[FONT_TEXCOORD] );
   glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_TEXCOORD] );
   glBufferData( GL_ARRAY_BUFFER, sizeof(float)* 2 * texcoords.size(), &texcoords[0], GL_STATIC_DRAW );
-  glEnableVertexAttribArray( FONT_TEXCOORD );
-  glVertexAttribPointer( FONT_TEXCOORD, 2, GL_FLOAT, false, 0, 0 );
 
-  glGenBuffers( 1, &vbos[FONT_VERTSCALEBIAS] );
-  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_VERTSCALEBIAS] );
-  glEnableVertexAttribArray( FONT_VERTSCALEBIAS );
-  glVertexAttribPointer( FONT_VERTSCALEBIAS, 4, GL_FLOAT, false, sizeof( mm::vec4 ), 0 );
-  glVertexAttribDivisor( FONT_VERTSCALEBIAS, 1 );
+  glGenBuffers( 1, &vbos[FONT_FACE] );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, vbos[FONT_FACE] );
+  glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned)* 3 * faces.size(), &faces[0], GL_STATIC_DRAW );
+  glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, 0 );
 
-  glGenBuffers( 1, &vbos[FONT_TEXSCALEBIAS] );
-  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_TEXSCALEBIAS] );
-  glEnableVertexAttribArray( FONT_TEXSCALEBIAS );
-  glVertexAttribPointer( FONT_TEXSCALEBIAS, 4, GL_FLOAT, false, sizeof( mm::vec4 ), 0 );
-  glVertexAttribDivisor( FONT_TEXSCALEBIAS, 1 );
+  glyph_stream.set_up( FONT_STREAM_SIZE );
+  batch_stream.set_up( FONT_BATCH_STREAM_SIZE );
+  retained_instances.set_up( FONT_RETAINED_SIZE );
+  retained_batches.set_up( FONT_RETAINED_BATCH_SIZE );
 
-  glGenBuffers( 1, &vbos[FONT_COLOR] );
-  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_COLOR] );
-  glEnableVertexAttribArray( FONT_COLOR );
-  glVertexAttribPointer( FONT_COLOR, 4, GL_FLOAT, false, sizeof( mm::vec4 ), 0 );
-  glVertexAttribDivisor( FONT_COLOR, 1 );
+  //the immediate and the retained glyphs only differ in their instance buffer
+  set_up_vao( vao );
+  set_up_vao( retained_vao );
+
+  glGenBuffers( 1, &glyph_ssbo );
+  glGenBuffers( 1, &indirect_buffer );
+  glGenBuffers( 1, &pbo );
+
+  rasterizer = new glyph_rasterizer();
+
+  //style 0 is a plain sdf glyph
+  styles.push_back( sdf_style() );
+
+  glGenBuffers( 1, &style_ubo );
+  glBindBuffer( GL_UNIFORM_BUFFER, style_ubo );
+  glBufferData( GL_UNIFORM_BUFFER, sizeof( sdf_style ) * FONT_MAX_SDF_STYLES, 0, GL_DYNAMIC_DRAW );
+  glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+  //effect 0 leaves the glyphs alone
+  effects.push_back( text_effect() );
+
+  glGenBuffers( 1, &effect_ubo );
+  glBindBuffer( GL_UNIFORM_BUFFER, effect_ubo );
+  glBufferData( GL_UNIFORM_BUFFER, sizeof( text_effect ) * FONT_MAX_TEXT_EFFECTS, 0, GL_DYNAMIC_DRAW );
+  glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+
+  is_set_up = true;
+}
+
+void library::set_up_vao( GLuint& v )
+{
+  glGenVertexArrays( 1, &v );
+  glBindVertexArray( v );
+
+  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_VERTEX] );
+  glEnableVertexAttribArray( FONT_VERTEX );
+  glVertexAttribPointer( FONT_VERTEX, 2, GL_FLOAT, false, 0, 0 );
+
+  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_TEXCOORD] );
+  glEnableVertexAttribArray( FONT_TEXCOORD );
+  glVertexAttribPointer( FONT_TEXCOORD, 2, GL_FLOAT, false, 0, 0 );
 
-  glGenBuffers( 1, &vbos[FONT_FACE] );
   glBindBuffer( GL_ELEMENT_ARRAY_BUFFER, vbos[FONT_FACE] );
-  glBufferData( GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned)* 3 * faces.size(), &faces[0], GL_STATIC_DRAW );
-  glGenBuffers( 1, &vbos[FONT_TRANSFORM] );
-  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_TRANSFORM] );
 
-  for( int c = 0; c < 4; ++c )
+  //per instance attributes, all interleaved in one instance buffer
+  for( int c = FONT_INSTANCE_POS; c <= FONT_INSTANCE_BATCH; ++c )
   {
-    glEnableVertexAttribArray( FONT_TRANSFORM + c );
-    glVertexAttribPointer( FONT_TRANSFORM + c, 4, GL_FLOAT, false, sizeof( mm::mat4 ), ( (char*)0 ) + sizeof( mm::vec4 ) * c );
-    glVertexAttribDivisor( FONT_TRANSFORM + c, 1 );
+    glEnableVertexAttribArray( c );
+    glVertexAttribDivisor( c, 1 );
   }
 
-  glGenBuffers( 1, &vbos[FONT_FILTER] );
-  glBindBuffer( GL_ARRAY_BUFFER, vbos[FONT_FILTER] );
-  glEnableVertexAttribArray( FONT_FILTER + 3 );
-  glVertexAttribPointer( FONT_FILTER + 3, 1, GL_FLOAT, false, sizeof( float ), 0 );
-  glVertexAttribDivisor( FONT_FILTER + 3, 1 );
-
   glBindVertexArray( 0 );
+}
 
-  is_set_up = true;
+//points the instance attributes of the bound vao at buffer
+void library::bind_instance_attributes( GLuint buffer )
+{
+  GLsizei stride = sizeof( glyph_instance );
+
+  glBindBuffer( GL_ARRAY_BUFFER, buffer );
+  glVertexAttribPointer( FONT_INSTANCE_POS, 2, GL_FLOAT, false, stride, ( (char*)0 ) + offsetof( glyph_instance, pos ) );
+  glVertexAttribIPointer( FONT_INSTANCE_SIZE, 2, GL_UNSIGNED_SHORT, stride, ( (char*)0 ) + offsetof( glyph_instance, size ) );
+  glVertexAttribIPointer( FONT_INSTANCE_GLYPH, 1, GL_UNSIGNED_INT, stride, ( (char*)0 ) + offsetof( glyph_instance, glyph ) );
+  glVertexAttribIPointer( FONT_INSTANCE_BATCH, 1, GL_UNSIGNED_INT, stride, ( (char*)0 ) + offsetof( glyph_instance, batch_flags ) );
+}
+
+//mirrors the glyph metrics (font_data) into the shader storage buffer
+//only the range touched since the last frame is uploaded
+void library::bind_glyph_data()
+{
+  if( font_data.size() > glyph_ssbo_size )
+  {
+    glyph_ssbo_size = std::max( (size_t)1024, font_data.size() * 2 );
+
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, glyph_ssbo );
+    glBufferData( GL_SHADER_STORAGE_BUFFER, sizeof( fontscalebias ) * glyph_ssbo_size, 0, GL_DYNAMIC_DRAW );
+    glBufferSubData( GL_SHADER_STORAGE_BUFFER, 0, sizeof( fontscalebias ) * font_data.size(), &font_data[0] );
+
+    dirty_begin = dirty_end = 0;
+  }
+  else if( dirty_begin < dirty_end )
+  {
+    glBindBuffer( GL_SHADER_STORAGE_BUFFER, glyph_ssbo );
+    glBufferSubData( GL_SHADER_STORAGE_BUFFER, sizeof( fontscalebias ) * dirty_begin, sizeof( fontscalebias ) * ( dirty_end - dirty_begin ), &font_data[dirty_begin] );
+
+    dirty_begin = dirty_end = 0;
+  }
+
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, FONT_GLYPH_BINDING, glyph_ssbo );
 }
 
 bool library::expand_tex()
@@ -222,628 +951,2424 @@ bool library::expand_tex()
     glTexParameteri( GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE );
     glTexImage2D( GL_TEXTURE_RECTANGLE, 0, GL_R8, texsize.x, texsize.y, 0, GL_RED, GL_UNSIGNED_BYTE, buf );
 
-    texture_pen.x = 1;
-    texture_pen.y = 1;
-    texture_row_h = 0;
+    atlas.reset( texsize.x, texsize.y );
 
     delete[] buf;
   }
   else
   {
-    GLubyte* buf = new GLubyte[texsize.x * texsize.y];
+    if( texsize.y >= MAX_TEX_SIZE ) //can't expand tex further
+    {
+      return false;
+    }
+
+    //double the height, so filling up the atlas only takes a few grows
+    GLuint new_tex;
+    int new_height = std::min( texsize.y * 2, (unsigned)MAX_TEX_SIZE );
+
+    glGenTextures( 1, &new_tex );
+    glBindTexture( GL_TEXTURE_RECTANGLE, new_tex );
+    glTexParameteri( GL_TEXTURE_RECTANGLE, GL_TEXTURE_MIN_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_RECTANGLE, GL_TEXTURE_MAG_FILTER, GL_NEAREST );
+    glTexParameteri( GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_RECTANGLE, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+
+    //the new rows are left undefined, every glyph upload
+    //carries its own empty border
+    glTexImage2D( GL_TEXTURE_RECTANGLE, 0, GL_R8, texsize.x, new_height, 0, GL_RED, GL_UNSIGNED_BYTE, 0 );
 
-    glGetTexImage( GL_TEXTURE_RECTANGLE, 0, GL_RED, GL_UNSIGNED_BYTE, buf );
+    //copy the old contents on the gpu, no readback, no reupload
+    //glyphs keep their texcoords, as the atlas only grows in height
+    glCopyImageSubData( tex, GL_TEXTURE_RECTANGLE, 0, 0, 0, 0,
+                        new_tex, GL_TEXTURE_RECTANGLE, 0, 0, 0, 0,
+                        texsize.x, texsize.y, 1 );
 
-    int tmp_height = texsize.y;
-    texsize.y += MIN_TEX_SIZE;
+    glDeleteTextures( 1, &tex );
+    tex = new_tex;
 
-    if( texsize.y > MAX_TEX_SIZE ) //can't expand tex further
+    texsize.y = new_height;
+    atlas.grow( texsize.y );
+  }
+
+  return true;
+}
+
+shared_face* library::acquire_face( const std::string& filename, unsigned int index )
+{
+  for( auto& sf : shared_faces )
+  {
+    if( sf->filename == filename && sf->index == index )
     {
-      return false;
+      ++sf->refs;
+      return sf;
     }
+  }
+
+  shared_face* sf = new shared_face();
+  sf->filename = filename;
+  sf->index = index;
+  sf->refs = 1;
+  sf->face = 0;
+  sf->file_hash = 0;
 
-    GLubyte* tmpbuf = new GLubyte[texsize.x * texsize.y];
-    memset( tmpbuf, 0, texsize.x * texsize.y * sizeof( GLubyte ) );
+  if( !sf->file.open( filename ) )
+  {
+    std::cerr << "Couldn't open file: " << filename << std::endl;
+    delete sf;
+    return 0;
+  }
 
-    glTexImage2D( GL_TEXTURE_RECTANGLE, 0, GL_R8, texsize.x, texsize.y, 0, GL_RED, GL_UNSIGNED_BYTE, tmpbuf );
-    glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, 0, 0, texsize.x, tmp_height, GL_RED, GL_UNSIGNED_BYTE, buf );
+  sf->face = open_face( (FT_Library)the_library, sf->file.get_data(), sf->file.get_size(), index );
 
-    delete[] buf;
-    delete[] tmpbuf;
+  if( !sf->face )
+  {
+    std::cerr << "Error loading font face: " << filename << std::endl;
+    delete sf;
+    return 0;
   }
 
-  return true;
+  sf->file_hash = sf->file.hash();
+  shared_faces.push_back( sf );
+
+  return sf;
+}
+
+void library::release_face( shared_face* sf )
+{
+  if( !sf || --sf->refs > 0 )
+    return;
+
+  //the threads read the mapping too
+  if( rasterizer )
+    rasterizer->drop_face( sf );
+
+  //frees its sizes too
+  FT_Done_Face( sf->face );
+
+  shared_faces.erase( std::find( shared_faces.begin(), shared_faces.end(), sf ) );
+  delete sf;
+}
+
+font_inst::face::face() : size( 0 ), sdf( false ), shared( 0 ), the_face( 0 ), glyphs( 0 ), requested( 0 ), failed( 0 ), failed_evictions( 0 ), kerning_data( 0 ), digits( 0 )
+{
+}
+
+font_inst::face::face( const std::string& filename, unsigned int index, bool is_sdf ) : size( 0 ), sdf( is_sdf ), failed_evictions( 0 ), kerning_data( 0 ), digits( 0 )
+{
+  shared = library::get().acquire_face( filename, index );
+  the_face = shared ? shared->face : 0;
+
+  current.size = 0;
+  current.asc = current.desc = current.h = current.gap = current.upos = current.uthick = 0;
+
+  glyphs = new glyph_table<glyph>();
+  requested = new glyph_table<char>();
+  failed = new glyph_table<char>();
+}
+
+font_inst::face::~face()
+{
+  //TODO invalidate glyphs in the library, and its tex
+  //glyphs still rasterizing refer to this face
+  library::get().integrate_glyphs( true );
+
+  library::get().release_face( shared );
+  delete glyphs;
+  delete requested;
+  delete failed;
+  delete digits;
+
+  for( auto& k : kerning_caches )
+    delete k;
+}
+
+void font_inst::face::set_size( unsigned int val )
+{
+  if( the_face )
+  {
+    size = val;
+
+    for( auto& s : sizes )
+    {
+      if( s.size == size )
+      {
+        current = s;
+        activate_glyph_size();
+        set_kerning_cache();
+        return;
+      }
+    }
+
+    current.size = size;
+
+    //100x for precise metrics
+    activate_size( shared, FT_F26Dot6( size * 100.0f * 64.0f ) );
+    current.asc = ( ( (FT_Face)the_face )->size->metrics.ascender / 64.0f ) / 100.0f;
+    current.desc = ( ( (FT_Face)the_face )->size->metrics.descender / 64.0f ) / 100.0f;
+    current.h = ( ( (FT_Face)the_face )->size->metrics.height / 64.0f ) / 100.0f;
+    current.gap = current.h - current.asc + current.desc;
+
+    current.upos = ( (FT_Face)the_face )->underline_position / ( 64.0f*64.0f ) * size;
+    current.upos = std::round( current.upos );
+
+    if( current.upos > -2 )
+    {
+      current.upos = -2;
+    }
+
+    current.uthick = ( (FT_Face)the_face )->underline_thickness / ( 64.0f*64.0f ) * size;
+    current.uthick = std::round( current.uthick );
+
+    if( current.uthick < 1 )
+    {
+      current.uthick = 1;
+    }
+
+    sizes.push_back( current );
+
+    activate_glyph_size();
+
+    set_kerning_cache();
+  }
+}
+
+void library::request_glyph( font_inst& f, uint32_t codepoint )
+{
+  request_glyph( f, f.the_face->glyph_size(), codepoint );
 }
 
-font_inst::face::face() : size( 0 ), the_face( 0 ), glyphs( 0 )
+void library::request_glyph( font_inst& f, unsigned size, uint32_t codepoint )
 {
+  if( !f.the_face->shared || f.the_face->requested->find( size, codepoint ) )
+    return;
+
+  //a glyph that didn't fit waits until something is evicted
+  forget_failed_glyphs( f );
+
+  if( f.the_face->failed->find( size, codepoint ) )
+    return;
+
+  //the white glyph needs no freetype, it is made right here
+  if( codepoint == FONT_WHITE_GLYPH )
+  {
+    std::vector<rasterized_glyph> white( 1 );
+    white[0].owner = &f;
+    white[0].size = size;
+    make_white_glyph( white[0] );
+
+    upload_glyphs( white );
+    return;
+  }
+
+  f.the_face->requested->insert( size, codepoint );
+
+  rasterize_job j = { &f, f.the_face->shared, size, codepoint, f.the_face->sdf };
+  rasterizer->push( j );
+}
+
+void library::forget_failed_glyphs( font_inst& f )
+{
+  if( f.the_face->failed_evictions != glyph_evictions )
+  {
+    if( f.the_face->failed->size() )
+      f.the_face->failed->clear();
+
+    f.the_face->failed_evictions = glyph_evictions;
+  }
+}
+
+void library::integrate_glyphs( bool wait )
+{
+  if( !rasterizer )
+    return;
+
+  std::vector<rasterized_glyph> done;
+  rasterizer->collect( done, wait );
+
+  if( !done.empty() )
+    upload_glyphs( done );
+}
+
+//adds a glyph whose bitmap is (or is about to be) in the atlas at r,
+//r includes the 1 texel border
+glyph& library::insert_glyph( font_inst* f, unsigned size, uint32_t codepoint, const atlas_allocator::rect& r, int width, int rows, int left, int top, float advance, unsigned glyphid )
+{
+  mm::uvec2 texpen = mm::uvec2( r.x + 1, r.y + 1 );
+
+  glyph& g = f->the_face->glyphs->insert( size, codepoint );
+
+  g.glyphid = glyphid;
+  g.atlas_rect = r;
+  g.pinned = codepoint == FONT_WHITE_GLYPH;
+  g.last_used = frame;
+
+  g.offset_x = (float)left;
+  g.offset_y = (float)top;
+  g.w = (float)width;
+  g.h = (float)rows;
+
+  if( !g.pinned )
+  {
+    g.texcoords[0] = (float)texpen.x - 0.5f;
+    g.texcoords[1] = (float)texpen.y - 0.5f;
+    g.texcoords[2] = (float)texpen.x + (float)width + 0.5f;
+    g.texcoords[3] = (float)texpen.y + (float)rows + 0.5f;
+  }
+  else
+  {
+    g.texcoords[0] = (float)texpen.x;
+    g.texcoords[1] = (float)texpen.y;
+    g.texcoords[2] = (float)texpen.x + (float)width;
+    g.texcoords[3] = (float)texpen.y + (float)rows;
+  }
+
+  g.advance = advance;
+  g.kerning_index = cachestring_index( codepoint );
+
+  mm::vec2 vertbias = mm::vec2( g.offset_x - 0.5f, -0.5f - ( g.h - g.offset_y ) );
+  mm::vec2 vertscale = mm::vec2( g.offset_x + g.w + 0.5f, 0.5f + g.h - ( g.h - g.offset_y ) ) - vertbias;
+
+  mm::vec2 texbias = mm::vec2( g.texcoords[0], g.texcoords[1] );
+  mm::vec2 texscale = mm::vec2( g.texcoords[2], g.texcoords[3] ) - texbias;
+
+  g.cache_index = add_font_data( fontscalebias( vertscale, vertbias, texscale, texbias ) );
+
+  ++glyph_arrivals;
+
+  return g;
+}
+
+//puts finished glyphs into the atlas, all bitmaps are staged in one pbo,
+//the texture updates then source from it
+void library::upload_glyphs( std::vector<rasterized_glyph>& done )
+{
+  struct upload
+  {
+    atlas_allocator::rect r;
+    const rasterized_glyph* src;
+    size_t offset; //in the pbo
+  };
+
+  std::vector<upload> uploads;
+  size_t bytes = 0;
+
+  for( auto& rg : done )
+  {
+    font_inst::face* f = rg.owner->the_face;
+    f->requested->erase( rg.size, rg.codepoint );
+
+    if( f->glyphs->find( rg.size, rg.codepoint ) )
+      continue;
+
+    if( !rg.ok )
+      std::cerr << "Error loading character: " << (wchar_t)rg.codepoint << std::endl;
+
+    atlas_allocator::rect r;
+
+    if( !allocate_glyph( rg.width + 2, rg.rows + 2, r ) )
+    {
+      //everything in the atlas is in use this frame, reported once,
+      //request_glyph skips it until an eviction frees space
+      std::cerr << "Font atlas is full, couldn't add character: " << rg.codepoint << std::endl;
+      forget_failed_glyphs( *rg.owner );
+      f->failed->insert( rg.size, rg.codepoint );
+      continue;
+    }
+
+    insert_glyph( rg.owner, rg.size, rg.codepoint, r, rg.width, rg.rows, rg.left, rg.top, rg.advance, rg.glyphid );
+
+    ++frame_stats.rasterizations;
+
+    upload u = { r, &rg, bytes };
+    uploads.push_back( u );
+    bytes += rg.pixels.size();
+  }
+
+  if( uploads.empty() )
+    return;
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, pbo );
+
+  if( bytes > pbo_size )
+    pbo_size = std::max( bytes, pbo_size * 2 );
+
+  //orphan, the previous batch may still be read by the gpu
+  glBufferData( GL_PIXEL_UNPACK_BUFFER, pbo_size, 0, GL_STREAM_DRAW );
+
+  unsigned char* staging = (unsigned char*)glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT );
+
+  for( auto& u : uploads )
+    memcpy( staging + u.offset, &u.src->pixels[0], u.src->pixels.size() );
+
+  glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+
+  GLint uplast;
+  glGetIntegerv( GL_UNPACK_ALIGNMENT, &uplast );
+
+  if( uplast != 1 )
+  {
+    glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  }
+
+  glBindTexture( GL_TEXTURE_RECTANGLE, tex );
+
+  for( auto& u : uploads )
+    glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, u.r.x, u.r.y, u.r.w, u.r.h, GL_RED, GL_UNSIGNED_BYTE, ( (char*)0 ) + u.offset );
+
+  if( uplast != 1 )
+  {
+    glPixelStorei( GL_UNPACK_ALIGNMENT, uplast );
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
+
+void font_inst::face::set_kerning_cache()
+{
+  for( auto& k : kerning_caches )
+  {
+    if( k->size == glyph_size() )
+    {
+      kerning_data = k;
+      return;
+    }
+  }
+
+  //the dense table is filled when the size is prewarmed,
+  //either from the baked cache or by build_kerning
+  kerning_data = new kerning_cache();
+  kerning_data->size = glyph_size();
+  kerning_caches.push_back( kerning_data );
+}
+
+void font_inst::face::build_kerning()
+{
+  if( the_face && kerning_data && kerning_data->dense.empty() )
+  {
+    activate_glyph_size();
+    compute_dense_kerning( (FT_Face)the_face, kerning_data->dense );
+  }
+}
+
+//other font_insts may have activated another size of the shared face
+void font_inst::face::activate_glyph_size()
+{
+  activate_size( shared, FT_F26Dot6( glyph_size() ) * 64 );
+}
+
+float font_inst::face::kerning( const uint32_t prev, const uint32_t next )
+{
+  if( !the_face || !next || !kerning_data || kerning_data->dense.empty() )
+    return 0;
+
+  glyph* p = glyphs->find( glyph_size(), prev );
+  glyph* n = glyphs->find( glyph_size(), next );
+
+  if( !p || !n )
+    return 0;
+
+  //pairs outside the dense table are asked from freetype once
+  bool dense = p->kerning_index != ~0u && n->kerning_index != ~0u;
+
+  if( !dense && !kerning_data->pairs.find( prev, next ) )
+  {
+    FT_Vector kern;
+    activate_glyph_size();
+    FT_Get_Kerning( (FT_Face)the_face, p->glyphid, n->glyphid, FT_KERNING_UNFITTED, &kern );
+    kerning_data->pairs.insert( prev, next ) = kern.x / ( 64.0f*64.0f );
+  }
+
+  return cached_kerning( prev, next );
+}
+
+float font_inst::face::cached_kerning( const uint32_t prev, const uint32_t next )
+{
+  return current_size().cached_kerning( prev, next );
+}
+
+float font_inst::face::advance( const uint32_t current )
+{
+  return current_size().advance( current );
+}
+
+unsigned int font_inst::face::glyph_size()
+{
+  return sdf ? FONT_SDF_SIZE : size;
+}
+
+float font_inst::face::glyph_scale()
+{
+  return sdf ? size / float( FONT_SDF_SIZE ) : 1.0f;
+}
+
+font_inst::face::sized font_inst::face::current_size()
+{
+  sized r = { this, &current, kerning_data, glyph_size(), glyph_scale() };
+  return r;
+}
+
+font_inst::face::sized font_inst::face::at_size( unsigned s )
+{
+  sized r = { this, 0, 0, sdf ? FONT_SDF_SIZE : s, sdf ? s / float( FONT_SDF_SIZE ) : 1.0f };
+
+  for( auto& m : sizes )
+    if( m.size == s )
+      r.m = &m;
+
+  for( auto& k : kerning_caches )
+    if( k->size == r.glyph_size )
+      r.kern = k;
+
+  return r;
+}
+
+glyph* font_inst::face::sized::find( uint32_t c )
+{
+  return f->glyphs->find( glyph_size, c );
+}
+
+float font_inst::face::sized::advance( const uint32_t current )
+{
+  glyph* g = find( current );
+  return g ? g->advance * scale : 0;
+}
+
+float font_inst::face::sized::cached_kerning( const uint32_t prev, const uint32_t next )
+{
+  if( !f->the_face || !next || !kern || kern->dense.empty() )
+    return 0;
+
+  glyph* p = find( prev );
+  glyph* n = find( next );
+
+  if( !p || !n )
+    return 0;
+
+  if( p->kerning_index != ~0u && n->kerning_index != ~0u )
+    return kern->dense[p->kerning_index * cachestring.size() + n->kerning_index] * scale;
+
+  float* k = kern->pairs.find( prev, next );
+
+  return k ? *k * scale : 0;
+}
+
+float font_inst::face::height()
+{
+  return current.h;
+}
+
+float font_inst::face::linegap()
+{
+  return current.gap;
+}
+
+float font_inst::face::ascender()
+{
+  return current.asc;
+}
+
+float font_inst::face::descender()
+{
+  return current.desc;
+}
+
+float font_inst::face::underline_position()
+{
+  return current.upos;
+}
+
+float font_inst::face::underline_thickness()
+{
+  return current.uthick;
+}
+
+glyph& font_inst::face::get_glyph( uint32_t i )
+{
+  return glyphs->insert( glyph_size(), i );
+}
+
+bool font_inst::face::has_glyph( uint32_t i )
+{
+  return glyphs->find( glyph_size(), i ) != 0;
+}
+
+void font::set_size( font_inst& font_ptr, unsigned int s )
+{
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  //animations call this every frame, so it has to be nearly free
+  //when nothing changes
+  if( font_ptr.the_face->get_size() != s )
+    font_ptr.the_face->set_size( s );
+
+  if( font_ptr.the_face->glyphs->is_prewarmed( font_ptr.the_face->glyph_size() ) )
+    return;
+
+  if( !load_baked_glyphs( font_ptr ) )
+    font_ptr.the_face->build_kerning();
+
+  //glyphs missing from the cache go to freetype
+  std::for_each( cachestring.begin(), cachestring.end(),
+                 [&]( wchar_t & c )
+  {
+    add_glyph( font_ptr, c );
+  } );
+
+  font_ptr.the_face->glyphs->set_prewarmed( font_ptr.the_face->glyph_size() );
+
+  if( blocking_glyph_loads )
+    library::get().integrate_glyphs( true );
+}
+
+//baked atlas cache file:
+//header, baked_glyph[num_glyphs], float kerning[num_kerning],
+//unsigned char pixels[width * height]
+//the glyph rects are in the pixel block, the block goes into the
+//atlas as one rectangle
+#define FONT_CACHE_MAGIC 0x41464754 //"TGFA"
+#define FONT_CACHE_VERSION 1
+#define FONT_CACHE_WIDTH 512
+
+//rasterization flags of a cache
+#define FONT_CACHE_SDF 1
+
+struct baked_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint64_t font_hash;
+  uint32_t size; //glyph size
+  uint32_t flags;
+  uint32_t sdf_spread;
+  uint32_t charset_hash; //of the cachestring, which orders the kerning
+  uint32_t width, height;
+  uint32_t num_glyphs;
+  uint32_t num_kerning;
+};
+
+struct baked_glyph
+{
+  uint32_t codepoint;
+  uint32_t glyphid;
+  uint32_t x, y, w, h; //with the border
+  int32_t left, top;
+  float advance;
+};
+
+static uint32_t charset_hash()
+{
+  uint32_t h = 2166136261u;
+
+  for( auto& c : cachestring )
+  {
+    h ^= uint32_t( c );
+    h *= 16777619u;
+  }
+
+  return h;
+}
+
+static std::string cache_filename( const std::string& dir, uint64_t font_hash, unsigned int size, uint32_t flags )
+{
+  std::stringstream ss;
+  ss << dir << std::hex << font_hash << std::dec << "_" << size << ( flags & FONT_CACHE_SDF ? "_sdf" : "" ) << ".fontcache";
+  return ss.str();
+}
+
+bool font::load_baked_glyphs( font_inst& font_ptr )
+{
+  font_inst::face* f = font_ptr.the_face;
+
+  if( cache_dir.empty() || !f->shared )
+    return false;
+
+  uint32_t flags = f->sdf ? FONT_CACHE_SDF : 0;
+  unsigned int size = f->glyph_size();
+
+  mapped_file file;
+
+  if( !file.open( cache_filename( cache_dir, f->shared->file_hash, size, flags ) ) )
+    return false;
+
+  if( file.get_size() < sizeof( baked_header ) )
+    return false;
+
+  const baked_header* header = (const baked_header*)file.get_data();
+
+  if( header->magic != FONT_CACHE_MAGIC || header->version != FONT_CACHE_VERSION ||
+      header->font_hash != f->shared->file_hash || header->size != size || header->flags != flags ||
+      header->sdf_spread != FONT_SDF_SPREAD || header->charset_hash != charset_hash() )
+  {
+    std::cerr << "Stale font cache, rasterizing instead." << std::endl;
+    return false;
+  }
+
+  size_t num_kerning = header->num_kerning;
+  size_t expected = sizeof( baked_header ) + sizeof( baked_glyph ) * header->num_glyphs +
+                    sizeof( float ) * num_kerning + size_t( header->width ) * header->height;
+
+  if( file.get_size() < expected || ( num_kerning != 0 && num_kerning != cachestring.size() * cachestring.size() ) )
+  {
+    std::cerr << "Corrupt font cache, rasterizing instead." << std::endl;
+    return false;
+  }
+
+  const baked_glyph* glyphs = (const baked_glyph*)( header + 1 );
+  const float* kerning = (const float*)( glyphs + header->num_glyphs );
+  const unsigned char* pixels = (const unsigned char*)( kerning + num_kerning );
+
+  //the rects are uploaded into the atlas as they are, one outside the
+  //pixel block would write over other glyphs
+  bool fits = header->width > 0 && header->height > 0 && header->width <= MAX_TEX_SIZE && header->height <= MAX_TEX_SIZE;
+
+  for( unsigned c = 0; c < header->num_glyphs && fits; ++c )
+  {
+    const baked_glyph& b = glyphs[c];
+
+    fits = b.w >= 2 && b.h >= 2 && b.x <= header->width && b.w <= header->width - b.x &&
+           b.y <= header->height && b.h <= header->height - b.y;
+  }
+
+  if( !fits )
+  {
+    std::cerr << "Corrupt font cache, rasterizing instead." << std::endl;
+    return false;
+  }
+
+  auto& lib = library::get();
+
+  if( f->kerning_data && f->kerning_data->dense.empty() )
+    f->kerning_data->dense.assign( kerning, kerning + num_kerning );
+
+  GLint uplast, rowlast;
+  glGetIntegerv( GL_UNPACK_ALIGNMENT, &uplast );
+  glGetIntegerv( GL_UNPACK_ROW_LENGTH, &rowlast );
+
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+
+  //a rect of its own for every glyph, so evicting one frees all it used,
+  //the pixels come straight from the mapped file
+  for( unsigned c = 0; c < header->num_glyphs; ++c )
+  {
+    const baked_glyph& b = glyphs[c];
+
+    if( f->glyphs->find( size, b.codepoint ) )
+      continue;
+
+    //the rest go to freetype, see set_size
+    atlas_allocator::rect r;
+
+    if( !lib.allocate_glyph( b.w, b.h, r ) )
+      break;
+
+    lib.insert_glyph( &font_ptr, size, b.codepoint, r, b.w - 2, b.h - 2, b.left, b.top, b.advance, b.glyphid );
+
+    //allocating may have made a new texture, bound per glyph,
+    //the row length only applies to this upload
+    glBindTexture( GL_TEXTURE_RECTANGLE, lib.get_tex() );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, header->width );
+    glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, r.x, r.y, r.w, r.h, GL_RED, GL_UNSIGNED_BYTE, pixels + b.x + size_t( b.y ) * header->width );
+    glPixelStorei( GL_UNPACK_ROW_LENGTH, rowlast );
+  }
+
+  glPixelStorei( GL_UNPACK_ALIGNMENT, uplast );
+
+  return true;
+}
+
+bool font::bake_font_cache( const std::string& filename, unsigned int size, bool sdf )
+{
+  if( cache_dir.empty() )
+  {
+    std::cerr << "No font cache directory set." << std::endl;
+    return false;
+  }
+
+  mapped_file font_file;
+
+  if( !font_file.open( filename ) )
+  {
+    std::cerr << "Couldn't open file: " << filename << std::endl;
+    return false;
+  }
+
+  FT_Library lib;
+
+  if( FT_Init_FreeType( &lib ) )
+  {
+    std::cerr << "Error initializing the freetype library." << std::endl;
+    return false;
+  }
+
+  FT_Face f = open_face( lib, font_file.get_data(), font_file.get_size(), 0 );
+
+  if( !f )
+  {
+    std::cerr << "Error loading font face: " << filename << std::endl;
+    FT_Done_FreeType( lib );
+    return false;
+  }
+
+  unsigned int glyph_size = sdf ? FONT_SDF_SIZE : size;
+  set_glyph_size( f, glyph_size );
+
+  //rasterize and pack the cachestring
+  atlas_allocator packer;
+  unsigned height = 64;
+  packer.reset( FONT_CACHE_WIDTH, height );
+
+  std::vector<rasterized_glyph> rasterized( cachestring.size() );
+  std::vector<baked_glyph> glyphs( cachestring.size() );
+  unsigned used_height = 0;
+
+  for( size_t c = 0; c < cachestring.size(); ++c )
+  {
+    rasterized_glyph& r = rasterized[c];
+    r.owner = 0;
+    r.size = glyph_size;
+    r.codepoint = cachestring[c];
+
+    if( r.codepoint == FONT_WHITE_GLYPH )
+      make_white_glyph( r );
+    else
+      rasterize( f, sdf, r );
+
+    atlas_allocator::rect rect;
+    bool fits = r.width + 2 <= FONT_CACHE_WIDTH;
+
+    //the cache only grows in height
+    while( fits && !packer.allocate( r.width + 2, r.rows + 2, rect ) )
+    {
+      if( height >= MAX_TEX_SIZE )
+        fits = false;
+      else
+      {
+        height = std::min( height * 2, unsigned( MAX_TEX_SIZE ) );
+        packer.grow( height );
+      }
+    }
+
+    if( !fits )
+    {
+      std::cerr << "Glyph " << r.codepoint << " doesn't fit in the font cache at size " << glyph_size << std::endl;
+      FT_Done_Face( f );
+      FT_Done_FreeType( lib );
+      return false;
+    }
+
+    baked_glyph& b = glyphs[c];
+    b.codepoint = r.codepoint;
+    b.glyphid = r.glyphid;
+    b.x = rect.x;
+    b.y = rect.y;
+    b.w = rect.w;
+    b.h = rect.h;
+    b.left = r.left;
+    b.top = r.top;
+    b.advance = r.advance;
+
+    used_height = std::max( used_height, rect.y + rect.h );
+  }
+
+  std::vector<float> kerning;
+  compute_dense_kerning( f, kerning );
+
+  FT_Done_Face( f );
+  FT_Done_FreeType( lib );
+
+  std::vector<unsigned char> pixels( FONT_CACHE_WIDTH * used_height, 0 );
+
+  for( size_t c = 0; c < glyphs.size(); ++c )
+  {
+    const baked_glyph& b = glyphs[c];
+
+    for( unsigned y = 0; y < b.h; ++y )
+      memcpy( &pixels[b.x + ( b.y + y ) * FONT_CACHE_WIDTH], &rasterized[c].pixels[y * b.w], b.w );
+  }
+
+  baked_header header;
+  header.magic = FONT_CACHE_MAGIC;
+  header.version = FONT_CACHE_VERSION;
+  header.font_hash = font_file.hash();
+  header.size = glyph_size;
+  header.flags = sdf ? FONT_CACHE_SDF : 0;
+  header.sdf_spread = FONT_SDF_SPREAD;
+  header.charset_hash = charset_hash();
+  header.width = FONT_CACHE_WIDTH;
+  header.height = used_height;
+  header.num_glyphs = glyphs.size();
+  header.num_kerning = kerning.size();
+
+  std::string out_name = cache_filename( cache_dir, header.font_hash, glyph_size, header.flags );
+  std::ofstream out( out_name.c_str(), std::ios::out | std::ios::binary );
+
+  if( !out )
+  {
+    std::cerr << "Couldn't write font cache: " << out_name << std::endl;
+    return false;
+  }
+
+  out.write( (const char*)&header, sizeof( header ) );
+  out.write( (const char*)&glyphs[0], sizeof( baked_glyph ) * glyphs.size() );
+
+  if( !kerning.empty() )
+    out.write( (const char*)&kerning[0], sizeof( float ) * kerning.size() );
+
+  out.write( (const char*)&pixels[0], pixels.size() );
+
+  std::cout << "-Baked: " << out_name << std::endl;
+
+  return true;
+}
+
+float font::line_advance( font_inst& font_ptr, unsigned int size, float line_height )
+{
+  if( !font_ptr.the_face )
+    return 0;
+
+  set_size( font_ptr, size );
+
+  return ( font_ptr.the_face->height() - font_ptr.the_face->linegap() ) * line_height;
+}
+
+//true if the glyph is in the atlas, otherwise it is queued
+//for the rasterizer threads
+bool font::add_glyph( font_inst& font_ptr, uint32_t c )
+{
+  return add_glyph( font_ptr, font_ptr.the_face->glyph_size(), c );
+}
+
+bool font::add_glyph( font_inst& font_ptr, unsigned glyph_size, uint32_t c )
+{
+  glyph* g = font_ptr.the_face->glyphs->find( glyph_size, c );
+
+  if( g )
+  {
+    g->last_used = library::get().get_frame();
+    return true;
+  }
+
+  library::get().request_glyph( font_ptr, glyph_size, c );
+
+  //the white glyph is made synchronously
+  return font_ptr.the_face->glyphs->find( glyph_size, c ) != 0;
+}
+
+bool font::use_glyph( font_inst& font_ptr, unsigned glyph_size, uint32_t c, text_commands* rec )
+{
+  if( !rec )
+    return add_glyph( font_ptr, glyph_size, c );
+
+  return font_ptr.the_face->glyphs->find( glyph_size, c ) != 0;
+}
+
+void font::load_font( const std::string& filename, font_inst& font_ptr, unsigned int size, bool sdf )
+{
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  std::cout << "-Loading: " << filename << std::endl;
+
+  library::get().set_up();
+  resize( screensize );
+
+  //load directly from font
+  font_ptr.the_face = new font_inst::face( filename, 0, sdf );
+
+  set_size( font_ptr, size );
+
+  //the first text shouldn't miss the common glyphs
+  library::get().integrate_glyphs( true );
+
+  library::get().instances.push_back( &font_ptr );
+}
+
+void font::resize( const mm::uvec2& ss )
+{
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  screensize = ss;
+  font_frame.set_ortographic( 0.0f, (float)ss.x, 0.0f, (float)ss.y, 0.0f, 1.0f );
+}
+
+//these special unicode characters denote the text markup begin/end
+#define FONT_UNDERLINE_BEGIN L'\uE000'
+#define FONT_UNDERLINE_END L'\uE001'
+#define FONT_OVERLINE_BEGIN L'\uE002'
+#define FONT_OVERLINE_END L'\uE003'
+#define FONT_STRIKETHROUGH_BEGIN L'\uE004'
+#define FONT_STRIKETHROUGH_END L'\uE005'
+#define FONT_HIGHLIGHT_BEGIN L'\uE006'
+#define FONT_HIGHLIGHT_END L'\uE007'
+
+bool is_special( uint32_t c )
+{
+  return c == FONT_UNDERLINE_BEGIN ||
+         c == FONT_UNDERLINE_END ||
+         c == FONT_OVERLINE_BEGIN ||
+         c == FONT_OVERLINE_END ||
+         c == FONT_STRIKETHROUGH_BEGIN ||
+         c == FONT_STRIKETHROUGH_END ||
+         c == FONT_HIGHLIGHT_BEGIN ||
+         c == FONT_HIGHLIGHT_END;
+}
+
+//lays out txt at the current size of font_ptr, the glyph instances
+//go to out.add_instance / out.add_decoration, tagged with batch
+//instances are emitted line by line, so the ones of the lines before a
+//change stay valid
+template< class t >
+mm::vec2 font::layout( const utf8_view& txt, font_inst& font_ptr, unsigned pixel_size, float line_height, float max_width, unsigned align, unsigned batch, text_commands* rec, t& out, text_block* block, mm::vec2* size )
+{
+  //every metric comes from pixel_size, never from the face's current size
+  font_inst::face::sized sf = font_ptr.the_face->at_size( pixel_size );
+
+  if( !sf.m )
+  {
+    if( size )
+      *size = mm::vec2( 0 );
+
+    return mm::vec2( 0 );
+  }
+
+  hit_cells* hits = block && block->hit_testable ? &block->hits : 0;
+
+  //a block starts again at the line its change is on
+  unsigned first_line = block ? block->changed_line() : 0;
+
+  size_t start = first_line ? block->line_starts[first_line].offset : 0;
+  unsigned start_markup = first_line ? block->line_starts[first_line].markup : 0;
+  unsigned character = first_line ? block->line_starts[first_line].character : 0; //of ch, drives the text effects
+  utf8_view rest( txt.data + start, txt.size - start );
+
+  if( block )
+  {
+    block->instances.resize( first_line ? block->line_starts[first_line].instance : 0 );
+    block->line_starts.resize( first_line );
+  }
+
+  //queue every missing glyph up front, so the threads work on them
+  //in parallel, missing glyphs are skipped unless loads are blocking
+  bool missing = false;
+  uint32_t ch;
+
+  for( utf8_cursor cur( rest ); cur.next( ch ); )
+  {
+    if( ch == L'\n' || is_special( ch ) )
+      continue;
+
+    if( rec )
+      rec->used_glyphs.push_back( std::make_tuple( &font_ptr, sf.glyph_size, ch ) );
+
+    if( !use_glyph( font_ptr, sf.glyph_size, ch, rec ) )
+      missing = true;
+  }
+
+  if( missing && blocking_glyph_loads && !rec )
+    library::get().integrate_glyphs( true );
+
+  //decorations are the white glyph stretched over the run,
+  //they are left out while it's missing
+  if( !use_glyph( font_ptr, sf.glyph_size, FONT_WHITE_GLYPH, rec ) && rec )
+    rec->used_glyphs.push_back( std::make_tuple( &font_ptr, sf.glyph_size, FONT_WHITE_GLYPH ) );
+
+  glyph* white = sf.find( FONT_WHITE_GLYPH );
+  unsigned int white_glyph = white ? white->cache_index : 0;
+
+  //the markup state belongs to this call, so the same text always gives
+  //the same quads, decorated characters are merged into one run per line
+  enum
+  {
+    HIGHLIGHT, STRIKETHROUGH, UNDERLINE, OVERLINE, NUM_DECORATIONS
+  };
+
+  struct decoration_run
+  {
+    bool on, open;
+    float begin, end, y;
+  };
+
+  decoration_run runs[NUM_DECORATIONS];
+
+  for( int d = 0; d < NUM_DECORATIONS; ++d )
+  {
+    runs[d].on = ( start_markup >> d ) & 1;
+    runs[d].open = false;
+    runs[d].begin = runs[d].end = runs[d].y = 0;
+  }
+
+  auto& decos = rec ? rec->layout_decorations : layout_decorations;
+
+  auto flush = [&]( int d )
+  {
+    decoration_run& r = runs[d];
+
+    if( !r.open )
+      return;
+
+    r.open = false;
+
+    if( !white )
+      return;
+
+    //vert bias, hori scale, vert scale
+    mm::vec2 bias, scale;
+    unsigned flags = 0;
+
+    switch( d )
+    {
+      case HIGHLIGHT:
+        bias = mm::vec2( 0, sf.m->desc );
+        scale = mm::vec2( r.end - r.begin, sf.m->h + sf.m->gap );
+        flags = FONT_INSTANCE_HIGHLIGHT;
+        break;
+      case STRIKETHROUGH:
+        bias = mm::vec2( 0, sf.m->asc * 0.33f );
+        scale = mm::vec2( r.end - r.begin, sf.m->uthick );
+        break;
+      case UNDERLINE:
+        bias = mm::vec2( 0, sf.m->upos );
+        scale = mm::vec2( r.end - r.begin, sf.m->uthick );
+        break;
+      default:
+        bias = mm::vec2( 0, sf.m->asc );
+        scale = mm::vec2( r.end - r.begin, sf.m->uthick );
+        break;
+    }
+
+    mm::vec2 pos = mm::vec2( r.begin, r.y ) + bias;
+    decos.push_back( std::make_pair( mm::vec4( pos.x, pos.y, scale.x, scale.y ), flags ) );
+  };
+
+  //glyphs go after the decorations of their line, so highlights stay behind them
+  //both wait for the end of the line, the alignment moves them
+  auto& placed = rec ? rec->layout_glyphs : layout_glyphs;
+  placed.clear();
+  decos.clear();
+
+  float xx = 0;
+  float line_right = 0; //end of the last glyph that isn't a space
+  float widest = 0;
+
+  float vert_advance = sf.m->h - sf.m->gap;
+  vert_advance *= line_height;
+
+  float yy = vert_advance * ( first_line + 1 );
+
+  //line boxes for hit testing, from the descender up
+  float desc = sf.m->desc;
+
+  auto begin_line = [&]( size_t offset, unsigned first_character )
+  {
+    if( block )
+    {
+      unsigned markup = 0;
+
+      for( int d = 0; d < NUM_DECORATIONS; ++d )
+        markup |= unsigned( runs[d].on ) << d;
+
+      text_block::line_start l = { unsigned( offset ), unsigned( block->instances.size() ), markup, first_character };
+      block->line_starts.push_back( l );
+    }
+
+    if( hits )
+      hits->add_line( (float)screensize.y - yy + desc, (float)screensize.y - yy + desc + vert_advance );
+  };
+
+  auto end_line = [&]()
+  {
+    for( int d = 0; d < NUM_DECORATIONS; ++d )
+      flush( d );
+
+    float dx = 0;
+
+    if( max_width > 0 && align != FONT_ALIGN_LEFT )
+    {
+      dx = max_width - line_right;
+      dx = std::floor( align == FONT_ALIGN_CENTER ? dx * 0.5f : dx );
+    }
+
+    for( auto& d : decos )
+      out.add_decoration( mm::vec2( d.first.x + dx, d.first.y ), d.first.zw, white_glyph, batch, d.second );
+
+    for( auto& g : placed )
+      out.add_instance( mm::vec2( g.pos.x + dx, g.pos.y ), g.glyph, batch, g.character );
+
+    if( hits && dx != 0 )
+      hits->move_line( dx );
+
+    widest = std::max( widest, line_right );
+    decos.clear();
+    placed.clear();
+  };
+
+  auto kern = [&]( uint32_t p, uint32_t c )
+  {
+    return rec ? sf.cached_kerning( p, c ) : font_ptr.the_face->kerning( p, c );
+  };
+
+  if( hits )
+  {
+    if( first_line )
+      hits->truncate( first_line );
+    else
+      hits->clear();
+  }
+
+  begin_line( start, character );
+
+  //kerning against the newline, as if the text before was laid out
+  uint32_t prev = first_line ? L'\n' : 0;
+  utf8_cursor cur( rest );
+  const unsigned char* at = cur.p; //first byte of ch
+
+  //greedy wrapping, each word is measured once when it starts,
+  //from the advances and kerning the face already caches
+  bool in_word = false;
+  bool long_word = false; //wider than a line, broken anywhere
+
+  auto new_line = [&]( const unsigned char * p, unsigned first_character )
+  {
+    //runs continue on the next line as a new quad
+    end_line();
+
+    yy += vert_advance;
+    xx = 0;
+    line_right = 0;
+
+    begin_line( p - (const unsigned char*)txt.data, first_character );
+  };
+
+  for( ; cur.next( ch ); prev = ch, at = cur.p )
+  {
+    if( ch == L'\n' )
+    {
+      new_line( cur.p, ++character );
+      in_word = false;
+      continue;
+    }
+
+    if( ch == L' ' )
+      in_word = false;
+
+    if( is_special( ch ) )
+    {
+      int d = ch == FONT_HIGHLIGHT_BEGIN || ch == FONT_HIGHLIGHT_END ? HIGHLIGHT :
+              ch == FONT_STRIKETHROUGH_BEGIN || ch == FONT_STRIKETHROUGH_END ? STRIKETHROUGH :
+              ch == FONT_UNDERLINE_BEGIN || ch == FONT_UNDERLINE_END ? UNDERLINE : OVERLINE;
+
+      //the begin markers are the even ones
+      runs[d].on = ( ( ch - FONT_UNDERLINE_BEGIN ) & 1 ) == 0;
+
+      if( !runs[d].on )
+        flush( d );
+
+      continue;
+    }
+
+    //missing glyphs keep their index, so the timing doesn't shift when they arrive
+    unsigned index = character++;
+
+    //load (or just touch) the glyph before its metrics are used
+    if( !use_glyph( font_ptr, sf.glyph_size, ch, rec ) )
+      continue;
+
+    float advancex = sf.advance( ch );
+
+    if( max_width > 0 && ch != L' ' )
+    {
+      if( !in_word )
+      {
+        in_word = true;
+
+        float w = advancex;
+        uint32_t p = ch, c;
+
+        for( utf8_cursor ahead = cur; ahead.next( c ) && c != L' ' && c != L'\n'; )
+        {
+          if( is_special( c ) || !use_glyph( font_ptr, sf.glyph_size, c, rec ) )
+            continue;
+
+          w += kern( p, c ) + sf.advance( c );
+          p = c;
+        }
+
+        long_word = w > max_width;
+
+        if( xx > 0 && xx + ( prev ? kern( prev, ch ) : 0 ) + w > max_width )
+        {
+          new_line( at, index );
+          prev = 0;
+        }
+      }
+      else if( long_word && xx > 0 && xx + ( prev ? kern( prev, ch ) : 0 ) + advancex > max_width )
+      {
+        new_line( at, index );
+        prev = 0;
+      }
+    }
+
+    if( prev )
+    {
+      xx += kern( prev, ch );
+    }
+
+    mm::vec2 pos = mm::vec2( xx, (float)screensize.y - yy );
+
+    for( auto& r : runs )
+    {
+      if( !r.on )
+        continue;
+
+      if( !r.open )
+      {
+        r.open = true;
+        r.begin = xx;
+        r.y = pos.y;
+      }
+
+      r.end = xx + advancex;
+    }
+
+    if( hits )
+      hits->add_cell( xx, xx + advancex, unsigned( at - (const unsigned char*)txt.data ) );
+
+    if( ch != L' ' )
+    {
+      placed_glyph g = { pos, sf.find( ch )->cache_index, index };
+      placed.push_back( g );
+    }
+
+    xx += advancex;
+
+    if( ch != L' ' )
+      line_right = xx;
+  }
+
+  end_line();
+
+  if( size )
+    *size = mm::vec2( widest, yy );
+
+  yy -= vert_advance;
+
+  return mm::vec2( xx, yy );
+}
+
+//conservative test of glyph quads against a clip rect, as font.vs places
+//them: transform * ( corner * ext ) + bias + pos, where the corner is in [0, 1]
+struct quad_culler
+{
+  mm::vec2 col0, col1, t; //2x2 part of the batch transform and its translation
+  mm::vec4 clip;
+
+  //every quad with its bias + pos in [amin, amax] and size up to ext
+  bool reject( const mm::vec2& amin, const mm::vec2& amax, const mm::vec2& ext ) const
+  {
+    mm::vec2 h = ext * 0.5f;
+    mm::vec2 c = col0 * h.x + col1 * h.y + t + ( amin + amax ) * 0.5f;
+    mm::vec2 r = mm::vec2( std::abs( col0.x ) * h.x + std::abs( col1.x ) * h.y,
+                           std::abs( col0.y ) * h.x + std::abs( col1.y ) * h.y ) + ( amax - amin ) * 0.5f;
+
+    return c.x + r.x < clip.x || c.x - r.x > clip.z || c.y + r.y < clip.y || c.y - r.y > clip.w;
+  }
+
+  quad_culler( const mm::mat4& transform, const mm::vec4& c ) :
+    col0( transform[0].xy ), col1( transform[1].xy ), t( transform[3].xy ), clip( c )
+  {
+  }
+};
+
+//layout output filter of the immediate path, drops glyphs outside the clip
+template< class t >
+struct culling_sink
+{
+  t& out;
+  quad_culler cull;
+  const std::vector<fontscalebias>& font_data;
+  float scale;
+
+  void add_instance( const mm::vec2& pos, unsigned glyph, unsigned batch, unsigned character )
+  {
+    const mm::vec4& vsb = font_data[glyph].vertscalebias;
+    mm::vec2 p = pos + vsb.zw * scale;
+
+    if( !cull.reject( p, p, vsb.xy * scale ) )
+      out.add_instance( pos, glyph, batch, character );
+  }
+
+  void add_decoration( const mm::vec2& pos, const mm::vec2& size, unsigned white_glyph, unsigned batch, unsigned flags )
+  {
+    if( !cull.reject( pos, pos, size ) )
+      out.add_decoration( pos, size, white_glyph, batch, flags );
+  }
+
+  culling_sink( t& o, const quad_culler& c, const std::vector<fontscalebias>& fd, float s ) : out( o ), cull( c ), font_data( fd ), scale( s )
+  {
+  }
+};
+
+mm::vec4 font::current_clip()
+{
+  if( clip_stack.empty() )
+    return mm::vec4( 0, 0, (float)screensize.x, (float)screensize.y );
+
+  return clip_stack.back();
+}
+
+mm::vec4 font::clip_rect( const mm::vec4& rect, const mm::vec4& top )
+{
+  //to window coordinates, y points up
+  mm::vec4 c = mm::vec4( rect.x, (float)screensize.y - ( rect.y + rect.w ), rect.x + rect.z, (float)screensize.y - rect.y );
+
+  return mm::vec4( std::max( c.x, top.x ), std::max( c.y, top.y ), std::min( c.z, top.z ), std::min( c.w, top.w ) );
+}
+
+void font::push_clip_rect( const mm::vec4& rect )
+{
+  clip_stack.push_back( clip_rect( rect, current_clip() ) );
+}
+
+void font::pop_clip_rect()
+{
+  if( !clip_stack.empty() )
+    clip_stack.pop_back();
+}
+
+mm::vec2 font::add_to_render_list( const std::wstring& txt, font_inst& font_ptr, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f, unsigned sdf_style_id, float max_width, unsigned align )
+{
+  utf8_scratch.clear();
+  utf8_append( txt, utf8_scratch );
+
+  return add_to_render_list( utf8_view( utf8_scratch ), font_ptr, color, mat, highlight_color, line_height, f, sdf_style_id, max_width, align );
+}
+
+mm::vec2 font::add_to_render_list( const utf8_view& txt, font_inst& font_ptr, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f, unsigned sdf_style_id, float max_width, unsigned align )
+{
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  //0 selects the bitmap path in the shaders, decorations always use it
+  unsigned glyph_style = font_ptr.the_face->sdf ? sdf_style_id + 1 : 0;
+
+  //everything shared by the glyphs of this call goes into one batch
+  auto& lib = library::get();
+  mm::vec4 clip = current_clip();
+  unsigned batch = lib.add_batch( mat, color, highlight_color, f, font_ptr.the_face->glyph_scale(), glyph_style, clip, effect, effect_start );
+
+  culling_sink<library> out( lib, quad_culler( mat, clip ), lib.font_data, font_ptr.the_face->glyph_scale() );
+
+  size_t first = lib.glyph_stream.size();
+  mm::vec2 r = layout( txt, font_ptr, font_ptr.the_face->get_size(), line_height, max_width, align, batch, 0, out );
+  lib.add_draw( library::DRAW_IMMEDIATE, first, lib.glyph_stream.size() );
+
+  return r;
+}
+
+//layout output that is thrown away
+struct measure_sink
+{
+  void add_instance( const mm::vec2&, unsigned, unsigned, unsigned )
+  {
+  }
+
+  void add_decoration( const mm::vec2&, const mm::vec2&, unsigned, unsigned, unsigned )
+  {
+  }
+};
+
+mm::vec2 font::measure( const utf8_view& txt, font_inst& font_ptr, float line_height, float max_width )
+{
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  measure_sink out;
+  mm::vec2 size;
+  layout( txt, font_ptr, font_ptr.the_face->get_size(), line_height, max_width, FONT_ALIGN_LEFT, 0, 0, out, 0, &size );
+  return size;
+}
+
+//true if m only moves, the paragraph texture is then drawn 1:1
+static bool is_translation( const mm::mat4& m )
+{
+  return m[0].x == 1 && m[0].y == 0 && m[0].z == 0 && m[0].w == 0 &&
+         m[1].x == 0 && m[1].y == 1 && m[1].z == 0 && m[1].w == 0 &&
+         m[2].x == 0 && m[2].y == 0 && m[2].z == 1 && m[2].w == 0 && m[3].w == 1;
+}
+
+//paragraph textures: the instances of a cached block are rendered once
+//into an rgba texture with premultiplied alpha, then drawn as one quad
+bool font::cache_paragraph( text_block& b )
+{
+  auto& lib = library::get();
+
+  mm::vec2 lo = mm::vec2( std::floor( b.bounds_min.x ), std::floor( b.bounds_min.y ) );
+  mm::vec2 hi = b.bounds_max + b.max_quad;
+  mm::uvec2 size = mm::uvec2( unsigned( std::ceil( hi.x - lo.x ) ) + 1, unsigned( std::ceil( hi.y - lo.y ) ) + 1 );
+  size_t bytes = size_t( size.x ) * size.y * 4;
+
+  b.cache_last_used = lib.get_frame();
+
+  if( b.cache_tex && b.cache_valid )
+  {
+    lib.cached_draws.push_back( &b );
+    lib.add_draw( library::DRAW_PARAGRAPHS, lib.cached_draws.size() - 1, lib.cached_draws.size() );
+    return true;
+  }
+
+  //too big to ever fit, drawn glyph by glyph
+  if( size.x > MAX_TEX_SIZE || size.y > MAX_TEX_SIZE || bytes > lib.cache_budget )
+  {
+    if( b.cache_tex )
+      lib.release_paragraph( &b );
+
+    return false;
+  }
+
+  if( b.cache_tex && ( b.cache_size.x != size.x || b.cache_size.y != size.y ) )
+    lib.release_paragraph( &b );
+
+  if( !b.cache_tex )
+  {
+    //least recently used first, the ones drawn this frame stay
+    while( lib.cache_bytes + bytes > lib.cache_budget )
+    {
+      text_block* victim = 0;
+
+      for( auto& c : lib.cached_blocks )
+      {
+        if( c->cache_last_used != lib.get_frame() && ( !victim || c->cache_last_used < victim->cache_last_used ) )
+          victim = c;
+      }
+
+      if( !victim )
+        return false;
+
+      lib.release_paragraph( victim );
+    }
+
+    glGenTextures( 1, &b.cache_tex );
+    glBindTexture( GL_TEXTURE_2D, b.cache_tex );
+    glTexImage2D( GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0 );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+    glTexParameteri( GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+    glBindTexture( GL_TEXTURE_2D, 0 );
+
+    b.cache_size = size;
+    lib.cache_bytes += bytes;
+    lib.cached_blocks.push_back( &b );
+  }
+
+  b.cache_origin = lo;
+  b.cache_valid = true;
+  lib.cache_bakes.push_back( &b );
+  lib.cached_draws.push_back( &b );
+  lib.add_draw( library::DRAW_PARAGRAPHS, lib.cached_draws.size() - 1, lib.cached_draws.size() );
+
+  return true;
+}
+
+void font::set_paragraph_cache_budget( size_t bytes )
+{
+  auto& lib = library::get();
+  lib.cache_budget = bytes;
+
+  while( lib.cache_bytes > lib.cache_budget && !lib.cached_blocks.empty() )
+  {
+    auto victim = std::min_element( lib.cached_blocks.begin(), lib.cached_blocks.end(),
+                                    []( const text_block * a, const text_block * b )
+    {
+      return a->cache_last_used < b->cache_last_used;
+    } );
+
+    lib.release_paragraph( *victim );
+  }
+}
+
+void library::release_paragraph( text_block* b )
+{
+  glDeleteTextures( 1, &b->cache_tex );
+  b->cache_tex = 0;
+  b->cache_valid = false;
+  cache_bytes -= size_t( b->cache_size.x ) * b->cache_size.y * 4;
+
+  cached_blocks.erase( std::remove( cached_blocks.begin(), cached_blocks.end(), b ), cached_blocks.end() );
+  cache_bakes.erase( std::remove( cache_bakes.begin(), cache_bakes.end(), b ), cache_bakes.end() );
+  //the draw spans index cached_draws, so the entry stays
+  std::replace( cached_draws.begin(), cached_draws.end(), b, (text_block*)0 );
+}
+
+//expects the font shader to be bound
+void library::bake_paragraphs()
+{
+  GLint prev_fbo, viewport[4];
+  glGetIntegerv( GL_DRAW_FRAMEBUFFER_BINDING, &prev_fbo );
+  glGetIntegerv( GL_VIEWPORT, viewport );
+
+  if( !cache_fbo )
+    glGenFramebuffers( 1, &cache_fbo );
+
+  glBindFramebuffer( GL_DRAW_FRAMEBUFFER, cache_fbo );
+  glDrawBuffer( GL_COLOR_ATTACHMENT0 );
+
+  glBindVertexArray( retained_vao );
+
+  if( retained_generation != retained_instances.get_generation() )
+  {
+    retained_generation = retained_instances.get_generation();
+    bind_instance_attributes( retained_instances.get_buffer() );
+  }
+
+  glBindBufferBase( GL_SHADER_STORAGE_BUFFER, FONT_BATCH_BINDING, retained_batches.get_buffer() );
+  glUniform1ui( 1, 0 );
+
+  //the alpha accumulates too, so the texture comes out premultiplied
+  glBlendFuncSeparate( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+
+  const float zero[4] = { 0, 0, 0, 0 };
+
+  for( auto& b : cache_bakes )
+  {
+    glFramebufferTexture2D( GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, b->cache_tex, 0 );
+    glViewport( 0, 0, b->cache_size.x, b->cache_size.y );
+    glClearBufferfv( GL_COLOR, 0, zero );
+
+    mm::mat4 mvp = mm::ortographic( b->cache_origin.x, b->cache_origin.x + b->cache_size.x, b->cache_origin.y, b->cache_origin.y + b->cache_size.y, 0.0f, 1.0f );
+    glUniformMatrix4fv( 0, 1, false, &mvp[0].x );
+
+    //glyphs in place and unclipped, the quad gets the real transform and clip
+    glyph_batch baked = b->batch;
+    baked.transform = mm::mat4::identity;
+    baked.clip = mm::vec4( -1e30f, -1e30f, 1e30f, 1e30f );
+
+    retained_batches.update( b->batch_slot, &baked, 1 );
+    glDrawElementsInstancedBaseInstance( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, b->range_size, b->range_offset );
+    retained_batches.update( b->batch_slot, &b->batch, 1 );
+  }
+
+  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+  glBindFramebuffer( GL_DRAW_FRAMEBUFFER, prev_fbo );
+  glViewport( viewport[0], viewport[1], viewport[2], viewport[3] );
+
+  cache_bakes.clear();
+}
+
+void library::draw_paragraphs( const mm::mat4& mvp, size_t begin, size_t end )
+{
+  glUseProgram( cached_shader );
+  glUniformMatrix4fv( 0, 1, false, &mvp[0].x );
+
+  glBindVertexArray( vao );
+  glActiveTexture( GL_TEXTURE2 );
+  glBindSampler( 2, 0 );
+
+  glBlendFunc( GL_ONE, GL_ONE_MINUS_SRC_ALPHA );
+
+  for( size_t i = begin; i < end; ++i )
+  {
+    text_block* b = cached_draws[i];
+
+    if( !b )
+      continue;
+
+    glBindTexture( GL_TEXTURE_2D, b->cache_tex );
+    glUniformMatrix4fv( 1, 1, false, &b->batch.transform[0].x );
+    glUniform4f( 2, b->cache_origin.x, b->cache_origin.y, (float)b->cache_size.x, (float)b->cache_size.y );
+    glUniform4fv( 3, 1, &b->batch.clip.x );
+    glDrawElements( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0 );
+  }
+
+  glBindTexture( GL_TEXTURE_2D, 0 );
+  glActiveTexture( GL_TEXTURE0 );
+  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
+
+  //the font shader keeps its uniforms, the spans after this set the rest
+  bind_shader();
+}
+
+text_commands::text_commands( unsigned o ) : order( o ), effect( 0 ), effect_start( 0 )
+{
+  font& fnt = font::get();
+  std::lock_guard<std::mutex> lock( fnt.command_buffers_mutex );
+
+  auto it = std::upper_bound( fnt.command_buffers.begin(), fnt.command_buffers.end(), this,
+                              []( const text_commands * a, const text_commands * b )
+  {
+    return a->order < b->order;
+  } );
+
+  fnt.command_buffers.insert( it, this );
+}
+
+text_commands::~text_commands()
+{
+  font& fnt = font::get();
+  std::lock_guard<std::mutex> lock( fnt.command_buffers_mutex );
+
+  fnt.command_buffers.erase( std::find( fnt.command_buffers.begin(), fnt.command_buffers.end(), this ) );
+}
+
+mm::vec2 text_commands::add_to_render_list( const std::wstring& txt, font_inst& font_ptr, unsigned size, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f, unsigned sdf_style_id, float max_width, unsigned align )
+{
+  utf8_scratch.clear();
+  utf8_append( txt, utf8_scratch );
+
+  return add_to_render_list( utf8_view( utf8_scratch ), font_ptr, size, color, mat, highlight_color, line_height, f, sdf_style_id, max_width, align );
+}
+
+mm::vec2 text_commands::add_to_render_list( const utf8_view& txt, font_inst& font_ptr, unsigned size, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f, unsigned sdf_style_id, float max_width, unsigned align )
+{
+  read_write_lock::shared_guard lock( font::get().cache_lock );
+  return font::get().record( *this, txt, font_ptr, size, color, mat, highlight_color, line_height, f, sdf_style_id, max_width, align );
+}
+
+mm::vec2 font::record( text_commands& c, const utf8_view& txt, font_inst& font_ptr, unsigned size, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f, unsigned sdf_style_id, float max_width, unsigned align )
+{
+  //the merge sets the size once, so its metrics exist from then on
+  font_inst::face::sized sf = font_ptr.the_face->at_size( size );
+
+  if( !sf.m )
+  {
+    c.unprepared_sizes.push_back( std::make_pair( &font_ptr, size ) );
+    return mm::vec2( 0 );
+  }
+
+  glyph_batch b;
+  b.transform = mat;
+  b.color = color;
+  b.highlight_color = highlight_color;
+  b.filter = f;
+  b.scale = sf.scale;
+  b.style = font_ptr.the_face->sdf ? sdf_style_id + 1 : 0;
+  b.effect = c.effect;
+  b.clip = c.current_clip();
+  b.effect_start = c.effect_start;
+  b.padding[0] = b.padding[1] = b.padding[2] = 0;
+
+  unsigned batch = c.batches.size();
+  c.batches.push_back( b );
+
+  culling_sink<text_commands> out( c, quad_culler( mat, b.clip ), library::get().font_data, b.scale );
+
+  return layout( txt, font_ptr, size, line_height, max_width, align, batch, &c, out );
+}
+
+//the render thread's clip rects don't apply to recorded text
+mm::vec4 text_commands::current_clip()
+{
+  if( clip_stack.empty() )
+    return mm::vec4( 0, 0, (float)font::get().screensize.x, (float)font::get().screensize.y );
+
+  return clip_stack.back();
+}
+
+void text_commands::push_clip_rect( const mm::vec4& rect )
+{
+  clip_stack.push_back( font::get().clip_rect( rect, current_clip() ) );
+}
+
+void text_commands::pop_clip_rect()
+{
+  if( !clip_stack.empty() )
+    clip_stack.pop_back();
+}
+
+void font::merge_command_buffers()
+{
+  auto& lib = library::get();
+  std::lock_guard<std::mutex> lock( command_buffers_mutex );
+
+  for( auto& c : command_buffers )
+  {
+    //keep the recorded glyphs from being evicted, queue the missing ones
+    std::sort( c->used_glyphs.begin(), c->used_glyphs.end() );
+    c->used_glyphs.erase( std::unique( c->used_glyphs.begin(), c->used_glyphs.end() ), c->used_glyphs.end() );
+
+    for( auto& u : c->used_glyphs )
+      add_glyph( *std::get<0>( u ), std::get<1>( u ), std::get<2>( u ) );
+
+    //sizes that were recorded before they were ever set, the text
+    //shows up from the next frame on, the current size stays
+    for( auto& u : c->unprepared_sizes )
+    {
+      unsigned current = u.first->the_face->get_size();
+      set_size( *u.first, u.second );
+      set_size( *u.first, current );
+    }
+
+    //the instances index the buffer's batches
+    unsigned base = lib.batch_stream.size();
+
+    for( auto& b : c->batches )
+      lib.batch_stream.push() = b;
+
+    for( auto& i : c->instances )
+    {
+      glyph_instance& gi = lib.glyph_stream.push();
+      gi = i;
+      gi.batch_flags += base << 8;
+    }
+
+    c->batches.clear();
+    c->instances.clear();
+    c->used_glyphs.clear();
+    c->unprepared_sizes.clear();
+  }
+}
+
+//writes v backwards, ending at end, returns where it begins
+static char* format_digits( unsigned long long v, char* end )
+{
+  do
+  {
+    *--end = char( '0' + v % 10 );
+    v /= 10;
+  }
+  while( v );
+
+  return end;
+}
+
+void text_block::set_number( long long v )
+{
+  char buf[24];
+  char* end = buf + sizeof( buf );
+
+  char* p = format_digits( v < 0 ? 0ull - (unsigned long long)v : (unsigned long long)v, end );
+
+  if( v < 0 )
+    *--p = '-';
+
+  set_digits( p, end - p );
+}
+
+void text_block::set_number( double v, unsigned decimals )
+{
+  static const unsigned long long powers[] =
+  {
+    1ull, 10ull, 100ull, 1000ull, 10000ull, 100000ull, 1000000ull, 10000000ull, 100000000ull, 1000000000ull
+  };
+
+  decimals = std::min( decimals, 9u );
+
+  double scaled = std::abs( v ) * powers[decimals] + 0.5;
+
+  //nan shows as 0, huge values saturate
+  if( scaled != scaled )
+    scaled = 0;
+  else if( scaled > 9e18 )
+    scaled = 9e18;
+
+  unsigned long long m = (unsigned long long)scaled;
+
+  char buf[32];
+  char* end = buf + sizeof( buf );
+  char* p = end;
+
+  if( decimals > 0 )
+  {
+    unsigned long long frac = m % powers[decimals];
+
+    for( unsigned c = 0; c < decimals; ++c )
+    {
+      *--p = char( '0' + frac % 10 );
+      frac /= 10;
+    }
+
+    *--p = '.';
+  }
+
+  p = format_digits( m / powers[decimals], p );
+
+  //no -0.00
+  if( v < 0 && m > 0 )
+    *--p = '-';
+
+  set_digits( p, end - p );
+}
+
+mm::vec2 font::layout_number( text_block& b, font_inst& font_ptr )
+{
+  auto& lib = library::get();
+  font_inst::face& fc = *font_ptr.the_face;
+
+  if( !fc.digits )
+  {
+    fc.digits = new digit_table();
+    fc.digits->size = 0;
+  }
+
+  digit_table& d = *fc.digits;
+
+  for( int pass = 0; pass < 2; ++pass )
+  {
+    if( d.size == fc.glyph_size() && d.arrivals == lib.glyph_arrivals && d.evictions == lib.glyph_evictions )
+      break;
+
+    bool missing = false;
+
+    //queues the missing ones, that doesn't change the table
+    for( int c = 0; c < FONT_NUM_DIGITS; ++c )
+    {
+      if( !add_glyph( font_ptr, FONT_DIGITS[c] ) )
+        missing = true;
+    }
+
+    for( int c = 0; c < FONT_NUM_DIGITS; ++c )
+      d.glyphs[c] = fc.glyphs->find( fc.glyph_size(), FONT_DIGITS[c] );
+
+    d.size = fc.glyph_size();
+    d.arrivals = lib.glyph_arrivals;
+    d.evictions = lib.glyph_evictions;
+
+    if( !missing || !blocking_glyph_loads )
+      break;
+
+    lib.integrate_glyphs( true );
+  }
+
+  float scale = fc.glyph_scale();
+  float vert_advance = ( fc.height() - fc.linegap() ) * b.line_height;
+  mm::vec2 pos = mm::vec2( 0, (float)screensize.y - vert_advance );
+
+  if( b.hit_testable )
+  {
+    b.hits.clear();
+    b.hits.add_line( pos.y + fc.descender(), pos.y + fc.descender() + vert_advance );
+  }
+
+  for( size_t c = 0; c < b.text.size(); ++c )
+  {
+    char ch = b.text[c];
+    glyph* g = d.glyphs[ch >= '0' && ch <= '9' ? ch - '0' : ch == '-' ? 10 : 11];
+
+    //still rasterizing
+    if( !g )
+      continue;
+
+    g->last_used = lib.get_frame();
+    b.add_instance( pos, g->cache_index, b.batch_slot, unsigned( c ) );
+
+    if( b.hit_testable )
+      b.hits.add_cell( pos.x, pos.x + g->advance * scale, unsigned( c ) );
+
+    pos.x += g->advance * scale;
+  }
+
+  return mm::vec2( pos.x, 0 );
+}
+
+text_block::text_block() : f( 0 ), size( 0 ), line_height( 1 ), sdf_style_id( 0 ), range_offset( 0 ), range_size( 0 ), range_capacity( 0 ), batch_slot( ~0u ), layout_screen_height( 0 ), extent( 0 ), needs_layout( true ), needs_batch_update( true ), incomplete( false ), glyph_arrivals( 0 ), numeric( false ),
+  wrap_width( 0 ), align( FONT_ALIGN_LEFT ), layout_wrap_width( 0 ), changed_from( 0 ), cached( false ), cache_valid( false ), cache_tex( 0 ), cache_origin( 0 ), cache_size( 0 ), cache_last_used( 0 ), hit_testable( false )
+{
+  batch.transform = mm::mat4::identity;
+  batch.color = mm::vec4( 1 );
+  batch.highlight_color = mm::vec4( 1 );
+  batch.filter = 0;
+  batch.scale = 1;
+  batch.style = 0;
+  batch.effect = 0;
+  batch.clip = mm::vec4( 0 );
+  batch.effect_start = 0;
+  batch.padding[0] = batch.padding[1] = batch.padding[2] = 0;
+}
+
+text_block::~text_block()
+{
+  auto& lib = library::get();
+
+  lib.retained_instances.release( range_offset, range_capacity );
+
+  if( batch_slot != ~0u )
+    lib.retained_batches.release( batch_slot, 1 );
+
+  if( cache_tex )
+    lib.release_paragraph( this );
+
+  font::get().forget_block( this );
+}
+
+void text_block::get_word( size_t offset, size_t& begin, size_t& end )
+{
+  //markup characters start with 0xee in utf-8, no other byte of
+  //them is below 0x80, so bytes can be tested one by one
+  auto is_break = []( unsigned char c )
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == 0xee;
+  };
+
+  begin = end = std::min( offset, text.size() );
+
+  while( begin > 0 && !is_break( text[begin - 1] ) )
+    --begin;
+
+  while( end < text.size() && !is_break( text[end] ) )
+    ++end;
 }
 
-font_inst::face::face( const std::string& filename, unsigned int index )
+void font::add_to_render_list( text_block& b )
 {
-  FT_Error error;
-  error = FT_New_Face( (FT_Library)library::get().get_library(), filename.c_str(), index, (FT_Face*)&the_face );
-
-  upos = 0;
-  uthick = 0;
+  if( !b.f || !b.f->the_face )
+    return;
 
-  FT_Matrix matrix = { (int)( ( 1.0 / 64.0f ) * 0x10000L ),
-                       (int)( ( 0.0 ) * 0x10000L ),
-                       (int)( ( 0.0 ) * 0x10000L ),
-                       (int)( ( 1.0 ) * 0x10000L ) };
-  FT_Select_Charmap( *(FT_Face*)&the_face, FT_ENCODING_UNICODE );
-  FT_Set_Transform( *(FT_Face*)&the_face, &matrix, NULL );
+  std::lock_guard<read_write_lock> lock( cache_lock );
 
-  glyphs = new std::map< unsigned int, std::map<uint32_t, glyph> >();
+  //the block's size is only set while it's drawn, immediate text
+  //after this still gets the size its caller set
+  unsigned size = b.f->the_face->get_size();
+  set_size( *b.f, b.size );
 
-  if( error )
-  {
-    std::cerr << "Error loading font face: " << filename << std::endl;
-    the_face = 0;
-  }
-}
+  draw_block( b );
 
-font_inst::face::~face()
-{
-  //TODO invalidate glyphs in the library, and its tex
-  FT_Done_Face( (FT_Face)the_face );
-  delete glyphs;
+  if( size && size != b.size )
+    set_size( *b.f, size );
 }
 
-void font_inst::face::set_size( unsigned int val )
+void font::draw_block( text_block& b )
 {
-  if( the_face )
-  {
-    size = val;
+  auto& lib = library::get();
+  font_inst& font_ptr = *b.f;
 
-    FT_Set_Char_Size( (FT_Face)the_face, size * 100.0f * 64.0f, 0.0f, 72 * 64.0f, 72 );
-    asc = ( ( (FT_Face)the_face )->size->metrics.ascender / 64.0f ) / 100.0f;
-    desc = ( ( (FT_Face)the_face )->size->metrics.descender / 64.0f ) / 100.0f;
-    h = ( ( (FT_Face)the_face )->size->metrics.height / 64.0f ) / 100.0f;
-    gap = h - asc + desc;
+  //a negative wrap width follows the window width
+  float wrap = b.wrap_width < 0 ? std::max( (float)screensize.x + b.wrap_width, 1.0f ) : b.wrap_width;
 
-    upos = ( (FT_Face)the_face )->underline_position / ( 64.0f*64.0f ) * size;
-    upos = std::round( upos );
+  if( wrap != b.layout_wrap_width || ( b.incomplete && b.glyph_arrivals != lib.glyph_arrivals ) )
+  {
+    b.needs_layout = true;
+    b.changed_from = 0;
+  }
 
-    if( upos > -2 )
+  //positions are from the top of the window, a new height alone moves
+  //the lines without wrapping them again
+  if( b.layout_screen_height != screensize.y )
+  {
+    if( b.needs_layout )
     {
-      upos = -2;
+      b.changed_from = 0;
     }
+    else
+    {
+      float dy = (float)screensize.y - (float)b.layout_screen_height;
 
-    uthick = ( (FT_Face)the_face )->underline_thickness / ( 64.0f*64.0f ) * size;
-    uthick = std::round( uthick );
+      for( auto& i : b.instances )
+        i.pos[1] += dy;
 
-    if( uthick < 1 )
-    {
-      uthick = 1;
-    }
+      if( !b.instances.empty() )
+        lib.retained_instances.update( b.range_offset, &b.instances[0], b.instances.size() );
 
-    FT_Set_Char_Size( (FT_Face)the_face, size * 64.0f, 0.0f, 72 * 64.0f, 72 );
+      b.bounds_min.y += dy;
+      b.bounds_max.y += dy;
+      b.cache_origin.y += dy;
+      b.hits.move( dy );
+      b.layout_screen_height = screensize.y;
+    }
   }
-}
 
-bool font_inst::face::load_glyph( unsigned int val )
-{
-  if( ( *glyphs )[size].count( val ) == 0 && the_face )
+  //keep the block's glyphs from being evicted, the instances point at
+  //their font_data, so a glyph that is gone or was reloaded to another
+  //slot means the layout is stale
+  if( !b.needs_layout )
   {
-    FT_Error error;
-
-    FT_GlyphSlot theglyph = FT_GlyphSlot();
-
-    if( val != wchar_t( -1 ) )
+    for( auto& u : b.used_glyphs )
     {
-      error = FT_Load_Char( (FT_Face)the_face, (const FT_UInt)val, FT_LOAD_RENDER | FT_LOAD_FORCE_AUTOHINT );
+      glyph* g = font_ptr.the_face->glyphs->find( font_ptr.the_face->glyph_size(), u.first );
 
-      if( error )
+      if( !g || g->cache_index != u.second )
       {
-        std::cerr << "Error loading character: " << (wchar_t)val << std::endl;
+        b.needs_layout = true;
+        b.changed_from = 0;
+        break;
       }
 
-      theglyph = ( (FT_Face)the_face )->glyph;
-    }
-    else
-    {
-      theglyph = new FT_GlyphSlotRec_();
-      theglyph->advance.x = 0;
-      theglyph->advance.y = 0;
-      static unsigned char data[4 * 4 * 3] = { -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-                                          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-                                          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
-                                          -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1 };
-      theglyph->bitmap.buffer = data;
-      theglyph->bitmap.rows = 4;
-      theglyph->bitmap.width = 4;
-      theglyph->bitmap_left = 0;
-      theglyph->bitmap_top = 0;
+      g->last_used = lib.get_frame();
     }
+  }
 
-    auto texsize = library::get().get_texsize();
-    auto& texpen = library::get().get_texture_pen();
-    auto& texrowh = library::get().get_tex_row_h();
-
-    if( texsize.x == 0 || texsize.y == 0 )
-    {
-      library::get().expand_tex();
-    }
+  if( b.batch_slot == ~0u )
+    b.batch_slot = lib.retained_batches.allocate( 1 );
 
-    FT_Bitmap* bitmap = &theglyph->bitmap;
+  if( b.needs_layout )
+  {
+    //the lines before the change keep their instances
+    unsigned first_line = b.numeric ? 0 : b.changed_line();
+    size_t first_changed = first_line ? b.line_starts[first_line].instance : 0;
+    size_t text_from = first_line ? b.line_starts[first_line].offset : 0;
 
-    if( texpen.x + bitmap->width + 1 > (int)texsize.x )
+    if( b.numeric )
     {
-      texpen.y += texrowh + 1;
-      texpen.x = 1;
-      texrowh = 0;
+      b.instances.clear();
+      b.line_starts.clear();
+      b.extent = layout_number( b, font_ptr );
     }
-
-    if( texpen.y + bitmap->rows + 1 > (int)texsize.y )
+    else
     {
-      if( !library::get().expand_tex() )
-      {
-        //tex expansion unsuccessful
-        return false;
-      }
+      b.extent = layout( b.text, font_ptr, font_ptr.the_face->get_size(), b.line_height, wrap, b.align, b.batch_slot, 0, b, &b );
     }
 
-    GLubyte* data;
-    int glyph_size = bitmap->width * bitmap->rows;
-    data = new GLubyte[glyph_size];
+    b.layout_wrap_width = wrap;
 
-    int c = 0;
+    b.changed_from = ~size_t( 0 );
+    b.layout_screen_height = screensize.y;
 
-    for( int y = 0; y < bitmap->rows; y++ )
+    //the glyphs of the kept lines are still in used_glyphs
+    if( !first_line )
     {
-      for( int x = 0; x < bitmap->width; x++ )
-      {
-        data[x + ( bitmap->rows - 1 - y ) * bitmap->width] = bitmap->buffer[c++];
-      }
+      b.used_glyphs.clear();
+      b.incomplete = false;
     }
 
-    GLint uplast;
-    glGetIntegerv( GL_UNPACK_ALIGNMENT, &uplast );
+    b.glyph_arrivals = lib.glyph_arrivals;
+    uint32_t c;
 
-    if( uplast != 1 )
+    for( utf8_cursor cur( utf8_view( b.text.data() + text_from, b.text.size() - text_from ) ); cur.next( c ); )
     {
-      glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+      glyph* g = font_ptr.the_face->glyphs->find( font_ptr.the_face->glyph_size(), c );
+
+      if( g )
+        b.used_glyphs.push_back( std::make_pair( c, g->cache_index ) );
+      else if( c != L'\n' && !is_special( c ) )
+        b.incomplete = true; //still rasterizing, lay out again once glyphs arrive
     }
 
-    glBindTexture( GL_TEXTURE_RECTANGLE, library::get().get_tex() );
-    glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, texpen.x, texpen.y, bitmap->width, bitmap->rows, GL_RED, GL_UNSIGNED_BYTE, data );
+    std::sort( b.used_glyphs.begin(), b.used_glyphs.end() );
+    b.used_glyphs.erase( std::unique( b.used_glyphs.begin(), b.used_glyphs.end() ), b.used_glyphs.end() );
 
-    delete[] data;
+    //the range keeps some slack, so typing doesn't move it every time,
+    //it's given back once the text shrinks to a quarter
+    size_t count = b.instances.size();
 
-    if( uplast != 1 )
+    if( count > b.range_capacity || count * 4 < b.range_capacity )
     {
-      glPixelStorei( GL_UNPACK_ALIGNMENT, uplast );
+      lib.retained_instances.release( b.range_offset, b.range_capacity );
+      b.range_capacity = count + count / 2;
+      b.range_offset = b.range_capacity > 0 ? lib.retained_instances.allocate( b.range_capacity ) : 0;
+      first_changed = 0;
     }
 
-    glyph* g = &( *glyphs )[size][val];
+    b.range_size = count;
 
-    g->glyphid = FT_Get_Char_Index( (FT_Face)the_face, (const FT_ULong)val );
+    //only the changed lines go up
+    if( count > first_changed )
+      lib.retained_instances.update( b.range_offset + first_changed, &b.instances[first_changed], count - first_changed );
 
-    g->offset_x = (float)theglyph->bitmap_left;
-    g->offset_y = (float)theglyph->bitmap_top;
-    g->w = (float)bitmap->width;
-    g->h = (float)bitmap->rows;
+    //bounds for culling the whole block, the kept lines are already in,
+    //a shrinking text leaves them conservative until the next full layout
+    float scale = font_ptr.the_face->glyph_scale();
 
-    if( val != wchar_t( -1 ) )
+    if( !first_line )
     {
-      g->texcoords[0] = (float)texpen.x - 0.5f;
-      g->texcoords[1] = (float)texpen.y - 0.5f;
-      g->texcoords[2] = (float)texpen.x + (float)bitmap->width + 0.5f;
-      g->texcoords[3] = (float)texpen.y + (float)bitmap->rows + 0.5f;
+      b.bounds_min = mm::vec2( FLT_MAX );
+      b.bounds_max = mm::vec2( -FLT_MAX );
+      b.max_quad = mm::vec2( 0 );
     }
-    else
+
+    for( size_t k = first_line ? first_changed : 0; k < count; ++k )
     {
-      g->texcoords[0] = (float)texpen.x;
-      g->texcoords[1] = (float)texpen.y;
-      g->texcoords[2] = (float)texpen.x + (float)bitmap->width;
-      g->texcoords[3] = (float)texpen.y + (float)bitmap->rows;
-    }
+      const glyph_instance& i = b.instances[k];
+      mm::vec2 p( i.pos[0], i.pos[1] ), ext;
 
-    texpen.x += bitmap->width + 1;
+      if( i.batch_flags & FONT_INSTANCE_DECORATION )
+      {
+        ext = mm::vec2( i.size[0], i.size[1] ) / 8.0f;
+      }
+      else
+      {
+        const mm::vec4& vsb = lib.font_data[i.glyph].vertscalebias;
+        p = p + vsb.zw * scale;
+        ext = vsb.xy * scale;
+      }
 
-    if( bitmap->rows > texrowh )
-    {
-      texrowh = bitmap->rows;
+      b.bounds_min = mm::vec2( std::min( b.bounds_min.x, p.x ), std::min( b.bounds_min.y, p.y ) );
+      b.bounds_max = mm::vec2( std::max( b.bounds_max.x, p.x ), std::max( b.bounds_max.y, p.y ) );
+      b.max_quad = mm::vec2( std::max( b.max_quad.x, ext.x ), std::max( b.max_quad.y, ext.y ) );
     }
 
-    g->advance = theglyph->advance;
+    b.needs_layout = false;
+    b.needs_batch_update = true; //the glyph scale follows the size
+    b.cache_valid = false;
   }
 
-  return true;
-}
+  mm::vec4 clip = current_clip();
 
-float font_inst::face::kerning( const uint32_t prev, const uint32_t next )
-{
-  if( the_face )
+  if( clip.x != b.batch.clip.x || clip.y != b.batch.clip.y || clip.z != b.batch.clip.z || clip.w != b.batch.clip.w )
   {
-    if( next && FT_HAS_KERNING( ( (FT_Face)the_face ) ) )
-    {
-      FT_Vector kern;
-      FT_Get_Kerning( (FT_Face)the_face, prev, next, FT_KERNING_UNFITTED, &kern );
-      return ( kern.x / ( 64.0f*64.0f ) );
-    }
-    else
-    {
-      return 0;
-    }
+    b.batch.clip = clip;
+    b.needs_batch_update = true;
   }
-  else
+
+  if( b.needs_batch_update )
   {
-    return 0;
+    b.batch.scale = font_ptr.the_face->glyph_scale();
+    b.batch.style = font_ptr.the_face->sdf ? b.sdf_style_id + 1 : 0;
+    lib.retained_batches.update( b.batch_slot, &b.batch, 1 );
+    b.needs_batch_update = false;
   }
-}
 
-float font_inst::face::advance( const uint32_t current )
-{
-  return ( ( *glyphs )[size][current].advance.x / 64.0f );
-}
+  //the instances are retained, so a block is culled as a whole,
+  //font.vs cuts the partly visible ones
+  //a texture can't show a text effect, animated blocks draw their glyphs
+  //and so do rotated or scaled ones, the texture would be resampled
+  bool from_texture = b.cached && b.batch.effect == 0 && is_translation( b.batch.transform );
 
-float font_inst::face::height()
-{
-  return h;
-}
+  if( !from_texture && b.cache_tex )
+    lib.release_paragraph( &b );
 
-float font_inst::face::linegap()
-{
-  return gap;
-}
+  if( b.range_size > 0 && !quad_culler( b.batch.transform, clip ).reject( b.bounds_min, b.bounds_max, b.max_quad ) )
+  {
+    if( b.hit_testable && !b.hits.empty() )
+    {
+      //glyph origins only move by the translation, see quad_culler
+      hit_entry e;
+      e.block = &b;
+      e.translation = b.batch.transform[3].xy;
 
-float font_inst::face::ascender()
-{
-  return asc;
-}
+      mm::vec2 lo = b.hits.get_bounds_min() + e.translation;
+      mm::vec2 hi = b.hits.get_bounds_max() + e.translation;
+      e.rect = mm::vec4( std::max( lo.x, clip.x ), std::max( lo.y, clip.y ), std::min( hi.x, clip.z ), std::min( hi.y, clip.w ) );
 
-float font_inst::face::descender()
-{
-  return desc;
-}
+      if( e.rect.x < e.rect.z && e.rect.y < e.rect.w )
+        hit_blocks.push_back( e );
+    }
 
-float font_inst::face::underline_position()
-{
-  return upos;
-}
+    if( from_texture && cache_paragraph( b ) )
+      return;
 
-float font_inst::face::underline_thickness()
-{
-  return uthick;
+    draw_command cmd = { 6, GLuint( b.range_size ), 0, 0, GLuint( b.range_offset ) };
+    lib.retained_draws.push_back( cmd );
+    lib.add_draw( library::DRAW_RETAINED, lib.retained_draws.size() - 1, lib.retained_draws.size() );
+  }
 }
 
-glyph& font_inst::face::get_glyph( uint32_t i )
-{
-  return ( *glyphs )[size][i];
-}
+#define FONT_HIT_GRID_CELL 32 //pixels
 
-bool font_inst::face::has_glyph( uint32_t i )
+void font::forget_block( text_block* b )
 {
-  try
+  auto is_b = [&]( const hit_entry & e )
   {
-    ( *glyphs ).at( size ).at( i );
-    return true;
-  }
-  catch( ... )
+    return e.block == b;
+  };
+
+  hit_blocks.erase( std::remove_if( hit_blocks.begin(), hit_blocks.end(), is_b ), hit_blocks.end() );
+
+  if( std::find_if( shown_hit_blocks.begin(), shown_hit_blocks.end(), is_b ) != shown_hit_blocks.end() )
   {
-    return false;
+    shown_hit_blocks.erase( std::remove_if( shown_hit_blocks.begin(), shown_hit_blocks.end(), is_b ), shown_hit_blocks.end() );
+    hit_grid_dirty = true;
   }
 }
 
-void font::set_size( font_inst& font_ptr, unsigned int s )
+void font::build_hit_grid()
 {
-  font_ptr.the_face->set_size( s );
-
-  std::for_each( cachestring.begin(), cachestring.end(),
-                 [&]( wchar_t & c )
-  {
-    add_glyph( font_ptr, c );
-  } );
+  shown_hit_grid.build( screensize, FONT_HIT_GRID_CELL, shown_hit_blocks );
+  hit_grid_dirty = false;
 }
 
-void font::add_glyph( font_inst& font_ptr, uint32_t c, int counter )
+bool font::hit_test( const mm::vec2& pos, text_block*& block, size_t& offset )
 {
-  if( font_ptr.the_face->has_glyph( c ) )
-    return;
-
-  if( !font_ptr.the_face->load_glyph( c ) )
-  {
-    if( counter > 9 ) //at max 10 tries
-    {
-      exit( 1 ); //couldn't get enough memory or something... (extreme case) 
-    }
+  if( hit_grid_dirty )
+    build_hit_grid();
 
-    library::get().delete_glyphs();
-    add_glyph( font_ptr, c, ++counter );
-    return;
-  }
+  //to window coordinates, y points up
+  mm::vec2 p = mm::vec2( pos.x, (float)screensize.y - pos.y );
 
-  auto& g = font_ptr.the_face->get_glyph( c );
+  //later blocks are drawn on top
+  return shown_hit_grid.visit( p, [&]( unsigned i )
+  {
+    const hit_entry& e = shown_hit_blocks[i];
 
-  g.cache_index = library::get().get_font_data_size();
+    if( p.x < e.rect.x || p.y < e.rect.y || p.x >= e.rect.z || p.y >= e.rect.w )
+      return false;
 
-  mm::vec2 vertbias = mm::vec2( g.offset_x - 0.5f, -0.5f - ( g.h - g.offset_y ) );
-  mm::vec2 vertscale = mm::vec2( g.offset_x + g.w + 0.5f, 0.5f + g.h - ( g.h - g.offset_y ) ) - vertbias;
+    unsigned o = e.block->hits.find( p - e.translation );
 
-  //texcoords
-  mm::vec2 texbias = mm::vec2( g.texcoords[0], g.texcoords[1] );
-  mm::vec2 texscale = mm::vec2( g.texcoords[2], g.texcoords[3] ) - texbias;
+    if( o == ~0u )
+      return false;
 
-  library::get().add_font_data( fontscalebias( vertscale, vertbias, texscale, texbias ) );
+    block = e.block;
+    offset = o;
+    return true;
+  } );
 }
 
-void font::load_font( const std::string& filename, font_inst& font_ptr, unsigned int size )
+void font::render()
 {
-  std::cout << "-Loading: " << filename << std::endl;
-
-  std::fstream f( filename.c_str(), std::ios::in );
-
-  if( !f )
-    std::cerr << "Couldn't open file: " << filename << std::endl;
-
-  f.close();
+  std::lock_guard<read_write_lock> lock( cache_lock );
+  glDisable( GL_CULL_FACE );
+  glDisable( GL_DEPTH_TEST );
+  glEnable( GL_BLEND );
+  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
 
-  library::get().set_up();
-  resize( screensize );
+  //the batch clip rects
+  for( int c = 0; c < 4; ++c )
+    glEnable( GL_CLIP_DISTANCE0 + c );
 
-  //load directly from font
-  font_ptr.the_face = new font_inst::face( filename, 0 );
+  library::get().bind_shader();
 
-  set_size( font_ptr, size );
+  //mvp is now only the projection matrix
+  mm::mat4 mat = font_frame.projection_matrix;
+  glUniformMatrix4fv( 0, 1, false, &mat[0].x );
 
-  library::get().instances.push_back( &font_ptr );
-}
+  auto& lib = library::get();
 
-void font::resize( const mm::uvec2& ss )
-{
-  screensize = ss;
-  font_frame.set_ortographic( 0.0f, (float)ss.x, 0.0f, (float)ss.y, 0.0f, 1.0f );
-}
+  //before the atlas changes, recorded text points at the glyphs as they are now
+  //it's drawn after everything added on this thread
+  size_t first_recorded = lib.glyph_stream.size();
+  merge_command_buffers();
+  lib.add_draw( library::DRAW_IMMEDIATE, first_recorded, lib.glyph_stream.size() );
 
-static std::vector<mm::vec4> vertscalebias;
-static std::vector<mm::vec4> texscalebias;
-static std::vector<mm::vec4> fontcolor;
-static std::vector<mm::mat4> transform;
-static std::vector<float> filter;
+  //glyphs finished since the last frame, drawn from the next one on
+  lib.integrate_glyphs( false );
 
-//these special unicode characters denote the text markup begin/end
-#define FONT_UNDERLINE_BEGIN L'\uE000'
-#define FONT_UNDERLINE_END L'\uE001'
-#define FONT_OVERLINE_BEGIN L'\uE002'
-#define FONT_OVERLINE_END L'\uE003'
-#define FONT_STRIKETHROUGH_BEGIN L'\uE004'
-#define FONT_STRIKETHROUGH_END L'\uE005'
-#define FONT_HIGHLIGHT_BEGIN L'\uE006'
-#define FONT_HIGHLIGHT_END L'\uE007'
+  glActiveTexture( GL_TEXTURE0 );
+  lib.bind_texture();
 
-bool is_special( wchar_t c )
-{
-  return c == FONT_UNDERLINE_BEGIN ||
-         c == FONT_UNDERLINE_END ||
-         c == FONT_OVERLINE_BEGIN ||
-         c == FONT_OVERLINE_END ||
-         c == FONT_STRIKETHROUGH_BEGIN ||
-         c == FONT_STRIKETHROUGH_END ||
-         c == FONT_HIGHLIGHT_BEGIN ||
-         c == FONT_HIGHLIGHT_END;
-}
+  lib.bind_vao();
 
-mm::vec2 font::add_to_render_list( const std::wstring& txt, font_inst& font_ptr, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float f )
-{
-  static bool underline = false;
-  static bool overline = false;
-  static bool strikethrough = false;
-  static bool highlight = false;
+  if( lib.stream_generation != lib.glyph_stream.get_generation() )
+  {
+    lib.stream_generation = lib.glyph_stream.get_generation();
+    lib.bind_instance_attributes( lib.glyph_stream.get_buffer() );
+  }
 
-  float yy = 0;
-  float xx = 0;
+  lib.bind_styles();
+  lib.bind_effects();
 
-  float vert_advance = font_ptr.the_face->height() - font_ptr.the_face->linegap();
-  vert_advance *= line_height;
+  //the text effects are evaluated from this
+  glUniform1f( 2, time );
 
-  yy += vert_advance;
+  lib.glyph_stream.flush();
+  lib.batch_stream.flush();
+  lib.bind_glyph_data();
 
-  for( int c = 0; c < int( txt.size() ); c++ )
+  //paragraph textures of changed blocks, before any text is drawn
+  if( !lib.cache_bakes.empty() )
   {
-    char bla = txt[c];
+    lib.bake_paragraphs();
+    glUniformMatrix4fv( 0, 1, false, &mat[0].x );
+    lib.bind_vao();
+  }
 
-    if( txt[c] == L'\n' )
-    {
-      yy += vert_advance;
-      xx = 0;
-    }
+  //text_blocks: one indirect command each, their instances and
+  //batches are already on the gpu, the commands go up once
+  if( !lib.retained_draws.empty() )
+  {
+    glBindVertexArray( lib.retained_vao );
 
-    if( c > 0 && txt[c] != L'\n' && !is_special( txt[c] ) )
+    if( lib.retained_generation != lib.retained_instances.get_generation() )
     {
-      xx += font_ptr.the_face->kerning( txt[c - 1], txt[c] );
+      lib.retained_generation = lib.retained_instances.get_generation();
+      lib.bind_instance_attributes( lib.retained_instances.get_buffer() );
     }
 
-    if( txt[c] == FONT_UNDERLINE_BEGIN )
-      underline = true;
-    else if( txt[c] == FONT_UNDERLINE_END )
-      underline = false;
-    else if( txt[c] == FONT_OVERLINE_BEGIN )
-      overline = true;
-    else if( txt[c] == FONT_OVERLINE_END )
-      overline = false;
-    else if( txt[c] == FONT_STRIKETHROUGH_BEGIN )
-      strikethrough = true;
-    else if( txt[c] == FONT_STRIKETHROUGH_END )
-      strikethrough = false;
-    else if( txt[c] == FONT_HIGHLIGHT_BEGIN )
-      highlight = true;
-    else if( txt[c] == FONT_HIGHLIGHT_END )
-      highlight = false;
-
-    float finalx = xx;
-    mm::vec3 pos = mm::vec3( finalx, (float)screensize.y - yy, 0 );
-
-    float advancex = 0;
-
-    int i = 0;
-    for( i = c; i < txt.size(); ++i )
-    {
-      if( !is_special( txt[i] ) )
-        break;
-    }
-    advancex = font_ptr.the_face->advance( txt[i] );
+    glBindBuffer( GL_DRAW_INDIRECT_BUFFER, lib.indirect_buffer );
+    glBufferData( GL_DRAW_INDIRECT_BUFFER, sizeof( draw_command ) * lib.retained_draws.size(), &lib.retained_draws[0], GL_STREAM_DRAW );
+  }
 
-    if( highlight )
+  //in the order the text was added, the spans alternate between the
+  //immediate instance stream and the retained buffers
+  for( auto& s : lib.draw_order )
+  {
+    if( s.kind == library::DRAW_IMMEDIATE )
     {
-      unsigned int datapos = font_ptr.the_face->get_glyph( wchar_t( -1 ) ).cache_index;
-      fontscalebias& fsb = library::get().get_font_data( datapos );
-      fontscalebias copy = fsb;
-
-      //vert bias
-      copy.vertscalebias.w = font_ptr.the_face->descender();
-
-      //hori bias
-      copy.vertscalebias.z = 0.0f;
+      //instances index this frame's batches relative to the batch region
+      lib.bind_vao();
+      glBindBufferBase( GL_SHADER_STORAGE_BUFFER, FONT_BATCH_BINDING, lib.batch_stream.get_buffer() );
+      glUniform1ui( 1, lib.batch_stream.base_instance() );
 
-      //hori scale
-      copy.vertscalebias.x = advancex;
-
-      //vert scale
-      copy.vertscalebias.y = font_ptr.the_face->height() + font_ptr.the_face->linegap();
-
-      vertscalebias.push_back( mm::vec4( copy.vertscalebias.xy, copy.vertscalebias.zw + pos.xy ) );
-      texscalebias.push_back( copy.texscalebias );
-      fontcolor.push_back( highlight_color );
-      transform.push_back( mat );
-      filter.push_back( f );
+      glDrawElementsInstancedBaseInstance( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, s.end - s.begin, lib.glyph_stream.base_instance() + s.begin );
     }
-
-    if( strikethrough )
+    else if( s.kind == library::DRAW_RETAINED )
     {
-      unsigned int datapos = font_ptr.the_face->get_glyph( wchar_t( -1 ) ).cache_index;
-      fontscalebias& fsb = library::get().get_font_data( datapos );
-      fontscalebias copy = fsb;
-
-      //vert bias
-      copy.vertscalebias.w = font_ptr.the_face->ascender() * 0.33f;
+      glBindVertexArray( lib.retained_vao );
+      glBindBufferBase( GL_SHADER_STORAGE_BUFFER, FONT_BATCH_BINDING, lib.retained_batches.get_buffer() );
+      glUniform1ui( 1, 0 );
 
-      //hori bias
-      copy.vertscalebias.z = 0;
-
-      //hori scale
-      copy.vertscalebias.x = advancex;
-
-      //vert scale
-      copy.vertscalebias.y = font_ptr.the_face->underline_thickness();
-
-      vertscalebias.push_back( mm::vec4( copy.vertscalebias.xy, copy.vertscalebias.zw + pos.xy ) );
-      texscalebias.push_back( copy.texscalebias );
-      fontcolor.push_back( color );
-      transform.push_back( mat );
-      filter.push_back( f );
+      glMultiDrawElementsIndirect( GL_TRIANGLES, GL_UNSIGNED_INT, ( (char*)0 ) + sizeof( draw_command ) * s.begin, s.end - s.begin, 0 );
     }
-
-    if( underline )
+    else
     {
-      unsigned int datapos = font_ptr.the_face->get_glyph( wchar_t( -1 ) ).cache_index;
-      fontscalebias& fsb = library::get().get_font_data( datapos );
-      fontscalebias copy = fsb;
-
-      //vert bias
-      copy.vertscalebias.w = font_ptr.the_face->underline_position();
-
-      //hori bias
-      copy.vertscalebias.z = 0.0f;
-
-      //hori scale
-      copy.vertscalebias.x = advancex;
-
-      //vert scale
-      copy.vertscalebias.y = font_ptr.the_face->underline_thickness();
-
-      vertscalebias.push_back( mm::vec4( copy.vertscalebias.xy, copy.vertscalebias.zw + pos.xy ) );
-      texscalebias.push_back( copy.texscalebias );
-      fontcolor.push_back( color );
-      transform.push_back( mat );
-      filter.push_back( f );
+      lib.draw_paragraphs( mat, s.begin, s.end );
     }
+  }
 
-    if( overline )
-    {
-      unsigned int datapos = font_ptr.the_face->get_glyph( wchar_t( -1 ) ).cache_index;
-      fontscalebias& fsb = library::get().get_font_data( datapos );
-      fontscalebias copy = fsb;
+  glBindBuffer( GL_DRAW_INDIRECT_BUFFER, 0 );
 
-      //vert bias
-      copy.vertscalebias.w = font_ptr.the_face->ascender();
+  lib.glyph_stream.finish_frame();
+  lib.batch_stream.finish_frame();
+  lib.retained_draws.clear();
+  lib.cached_draws.clear();
+  lib.draw_order.clear();
 
-      //hori bias
-      copy.vertscalebias.z = 0.0f;
+  shown_hit_blocks.swap( hit_blocks );
+  hit_blocks.clear();
+  hit_grid_dirty = true;
 
-      //hori scale
-      copy.vertscalebias.x = advancex;
+  lib.frame_stats.fill_ratio = lib.atlas.fill_ratio();
+  lib.last_frame_stats = lib.frame_stats;
+  lib.frame_stats = atlas_stats();
+  ++lib.frame;
 
-      //vert scale
-      copy.vertscalebias.y = font_ptr.the_face->underline_thickness();
+  glBindVertexArray( 0 );
 
-      vertscalebias.push_back( mm::vec4( copy.vertscalebias.xy, copy.vertscalebias.zw + pos.xy ) );
-      texscalebias.push_back( copy.texscalebias );
-      fontcolor.push_back( color );
-      transform.push_back( mat );
-      filter.push_back( f );
-    }
+  glUseProgram( 0 );
 
-    if( c < txt.size() && txt[c] != L' ' && txt[c] != L'\n' && !is_special( txt[c] ) )
-    {
-      add_glyph( font_ptr, txt[c] );
+  for( int c = 0; c < 4; ++c )
+    glDisable( GL_CLIP_DISTANCE0 + c );
 
-      unsigned int datapos = font_ptr.the_face->get_glyph( txt[c] ).cache_index;
-      auto thefsb = library::get().get_font_data( datapos );
-      vertscalebias.push_back( mm::vec4( thefsb.vertscalebias.xy, thefsb.vertscalebias.zw + pos.xy ) );
-      texscalebias.push_back( thefsb.texscalebias );
-      fontcolor.push_back( color );
-      transform.push_back( mat );
-      filter.push_back( f );
-    }
+  glDisable( GL_BLEND );
+  glEnable( GL_DEPTH_TEST );
+  glEnable( GL_CULL_FACE );
+}
+
+unsigned font::add_sdf_style( const sdf_style& s )
+{
+  auto& lib = library::get();
 
-    if( !is_special( txt[c] ) )
-      xx += font_ptr.the_face->advance( txt[c] );
+  if( lib.styles.size() >= FONT_MAX_SDF_STYLES )
+  {
+    std::cerr << "Too many sdf styles, using the default one." << std::endl;
+    return 0;
   }
 
-  yy -= vert_advance;
+  lib.styles.push_back( s );
+  lib.styles_dirty = true;
 
-  return mm::vec2( xx, yy );
+  return lib.styles.size() - 1;
 }
 
-void font::render()
+unsigned font::add_text_effect( const text_effect& e )
 {
-  glDisable( GL_CULL_FACE );
-  glDisable( GL_DEPTH_TEST );
-  glEnable( GL_BLEND );
-  glBlendFunc( GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA );
-
-  library::get().bind_shader();
-
-  //mvp is now only the projection matrix
-  mm::mat4 mat = font_frame.projection_matrix;
-  glUniformMatrix4fv( 0, 1, false, &mat[0].x );
+  auto& lib = library::get();
 
-  glActiveTexture( GL_TEXTURE0 );
-  library::get().bind_texture();
+  if( lib.effects.size() >= FONT_MAX_TEXT_EFFECTS )
+  {
+    std::cerr << "Too many text effects, the text won't be animated." << std::endl;
+    return 0;
+  }
 
-  library::get().bind_vao();
+  lib.effects.push_back( e );
+  lib.effects_dirty = true;
 
-  library::get().update_scalebiascolor( FONT_VERTSCALEBIAS, vertscalebias );
-  library::get().update_scalebiascolor( FONT_TEXSCALEBIAS, texscalebias );
-  library::get().update_scalebiascolor( FONT_COLOR, fontcolor );
-  library::get().update_scalebiascolor( FONT_TRANSFORM, transform );
-  library::get().update_scalebiascolor( FONT_FILTER, filter );
+  return lib.effects.size() - 1;
+}
 
-  glDrawElementsInstanced( GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, vertscalebias.size() );
+void font::set_text_effect( unsigned id, const text_effect& e )
+{
+  //0 stays no effect
+  auto& lib = library::get();
 
-  glBindVertexArray( 0 );
+  if( id > 0 && id < lib.effects.size() )
+  {
+    lib.effects[id] = e;
+    lib.effects_dirty = true;
+  }
+}
 
-  glUseProgram( 0 );
+void font::set_sdf_style( unsigned id, const sdf_style& s )
+{
+  auto& lib = library::get();
 
-  glDisable( GL_BLEND );
-  glEnable( GL_DEPTH_TEST );
-  glEnable( GL_CULL_FACE );
+  if( id < lib.styles.size() )
+  {
+    lib.styles[id] = s;
+    lib.styles_dirty = true;
 
-  vertscalebias.clear();
-  texscalebias.clear();
-  fontcolor.clear();
-  transform.clear();
-  filter.clear();
+    //they may have baked the old style
+    for( auto& b : lib.cached_blocks )
+      b->cache_valid = false;
+  }
 }
@@ -5,9 +5,20 @@
 
 #include "GL/glew.h"
 
+#include "glyph_table.h"
+#include "atlas_allocator.h"
+#include "instance_stream.h"
+#include "retained_buffer.h"
+#include "utf8.h"
+#include "hit_cells.h"
+
 #include <map>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
 #include <list>
 #include <string>
+#include <tuple>
 #include <vector>
 
 /*
@@ -15,10 +26,32 @@
  */
 
 struct glyph;
+struct kerning_cache;
+struct digit_table;
+struct rasterized_glyph;
+struct shared_face;
+class glyph_rasterizer;
 class font;
 class font_inst;
+class text_block;
+
+#define FONT_LIB_VBO_SIZE 3
+
+//glyph_instance flags
+#define FONT_INSTANCE_DECORATION 1 //size overrides the glyph metrics, always drawn as bitmap
+#define FONT_INSTANCE_HIGHLIGHT 2 //uses the batch's highlight color
 
-#define FONT_LIB_VBO_SIZE 8
+//where the lines of wrapped text go within the wrap width
+#define FONT_ALIGN_LEFT 0
+#define FONT_ALIGN_CENTER 1
+#define FONT_ALIGN_RIGHT 2
+
+//text_effect types, evaluated per character in font.vs
+#define FONT_EFFECT_NONE 0
+#define FONT_EFFECT_WAVE 1 //characters bob up and down one after another
+#define FONT_EFFECT_SHAKE 2 //characters jitter randomly
+#define FONT_EFFECT_REVEAL 3 //typewriter, characters fade and rise in one by one
+#define FONT_EFFECT_RAINBOW 4 //the color cycles through the hues along the text
 
 struct fontscalebias
 {
@@ -31,26 +64,218 @@ struct fontscalebias
   }
 };
 
+//one glyph quad, as the vertex shader reads it (20 bytes)
+//the quad's scale/bias comes from the glyph metrics buffer,
+//transform, colors and filter from the batch table
+struct glyph_instance
+{
+  float pos[2]; //glyph origin in batch space, mm::vec2 would pad it to 16 bytes
+  uint16_t size[2]; //decorations: in 1/8 pixels, glyphs: character index, low and high half
+  uint32_t glyph; //index into the glyph metrics (font_data)
+  uint32_t batch_flags; //batch index << 8 | flags
+};
+
+static_assert( sizeof( glyph_instance ) == 20, "glyph_instance is read as 20 byte vertex attributes" );
+
+//character is the index of the glyph's character in its text, text effects
+//delay each character by it
+inline glyph_instance make_glyph_instance( const mm::vec2& pos, unsigned glyph, unsigned batch, unsigned character )
+{
+  glyph_instance i;
+  i.pos[0] = pos.x;
+  i.pos[1] = pos.y;
+  i.size[0] = uint16_t( character & 0xffff );
+  i.size[1] = uint16_t( character >> 16 );
+  i.glyph = glyph;
+  i.batch_flags = batch << 8;
+  return i;
+}
+
+//solid quad of the given size, drawn with the white glyph
+inline glyph_instance make_decoration_instance( const mm::vec2& pos, const mm::vec2& size, unsigned white_glyph, unsigned batch, unsigned flags )
+{
+  glyph_instance i;
+  i.pos[0] = pos.x;
+  i.pos[1] = pos.y;
+  i.size[0] = (uint16_t)std::min( 65535.0f, std::max( 0.0f, size.x * 8.0f + 0.5f ) );
+  i.size[1] = (uint16_t)std::min( 65535.0f, std::max( 0.0f, size.y * 8.0f + 0.5f ) );
+  i.glyph = white_glyph;
+  i.batch_flags = ( batch << 8 ) | flags | FONT_INSTANCE_DECORATION;
+  return i;
+}
+
+//glyph of a line waiting for the line's alignment in the layout
+struct placed_glyph
+{
+  mm::vec2 pos;
+  unsigned glyph; //font_data index
+  unsigned character; //index in the text
+};
+
+//state shared by all glyphs of one add_to_render_list call
+//layout matches the std430 batch buffer in font.vs
+struct glyph_batch
+{
+  mm::mat4 transform;
+  mm::vec4 color;
+  mm::vec4 highlight_color;
+  float filter;
+  float scale; //glyph metrics -> pixels, != 1 for sdf fonts
+  unsigned style;
+  unsigned effect; //text_effect id, 0 for none
+  mm::vec4 clip; //min xy, max xy in window pixels, the quads are cut to it
+  float effect_start; //font time the effect starts at
+  float padding[3];
+};
+
+static_assert( sizeof( glyph_batch ) == 144, "must match the std430 batch buffer in font.vs" );
+
+//look of sdf glyphs, evaluated in font.ps in the same pass as the glyph
+//widths are in distance units, 0.5 reaches the edge of the sdf spread
+//the shadow offset is in atlas texels
+struct sdf_style
+{
+  mm::vec4 outline_color;
+  mm::vec4 glow_color;
+  mm::vec4 shadow_color;
+  float outline_width;
+  float glow_width;
+  float shadow_softness;
+  float padding;
+  mm::vec4 shadow_offset; //xy, zw is unused, mm::vec2 would be 16 bytes wide anyway
+
+  sdf_style() : outline_color( 0 ), glow_color( 0 ), shadow_color( 0 ),
+    outline_width( 0 ), glow_width( 0 ), shadow_softness( 0 ), padding( 0 ), shadow_offset( 0 )
+  {
+  }
+};
+
+static_assert( sizeof( sdf_style ) == 80, "must match the std140 sdf_styles block in font.ps" );
+
+//animation of every character of a text, evaluated in font.vs from the
+//font time, so animated text costs nothing on the cpu after it's laid out
+//only glyphs are animated, highlights, underlines, strikethroughs and
+//overlines stay as they are, so they show before a reveal reaches them
+//layout matches the std140 effect block in font.vs
+struct text_effect
+{
+  unsigned type; //FONT_EFFECT_*
+  unsigned easing; //transition::easing of one wave period or of a reveal
+  float speed; //wave, shake and rainbow cycles per second
+  float delay; //seconds between two characters
+  float amplitude; //pixels the characters move by
+  float duration; //of one character's reveal in seconds
+  float spread; //wave and rainbow cycles between two characters
+  float padding;
+
+  text_effect() : type( FONT_EFFECT_NONE ), easing( 0 ), speed( 1 ), delay( 0 ),
+    amplitude( 0 ), duration( 0 ), spread( 0 ), padding( 0 )
+  {
+  }
+};
+
+//glDrawElementsIndirect command, one per text_block drawn
+struct draw_command
+{
+  GLuint count;
+  GLuint instance_count;
+  GLuint first_index;
+  GLint base_vertex;
+  GLuint base_instance;
+};
+
+//per frame font atlas statistics
+struct atlas_stats
+{
+  float fill_ratio; //allocated area / atlas area
+  unsigned evictions; //glyphs thrown out of the atlas
+  unsigned rasterizations; //glyphs (re)loaded through freetype
+
+  atlas_stats() : fill_ratio( 0 ), evictions( 0 ), rasterizations( 0 )
+  {
+  }
+};
+
 class library
 {
   friend class font;
   friend class face;
   friend class font_inst;
+  friend class text_block;
+  template< class t > friend struct culling_sink;
 private:
   void* the_library;
-  mm::uvec2 texture_pen;
-  GLint texture_row_h;
+  atlas_allocator atlas;
+  unsigned frame; //frame counter, drives the glyph LRU
+  atlas_stats frame_stats, last_frame_stats;
   GLuint tex; //font texture
   GLuint texsampler_point, texsampler_linear;
   mm::uvec2 texsize;
   GLuint vao; //vao
   GLuint vbos[FONT_LIB_VBO_SIZE]; //vbos
+  instance_stream<glyph_instance> glyph_stream;
+  instance_stream<glyph_batch> batch_stream;
+  unsigned stream_generation; //of the stream buffer the vao points to
+  GLuint retained_vao; //same layout as vao, reads the retained instances
+  retained_buffer<glyph_instance> retained_instances; //text_block glyphs
+  retained_buffer<glyph_batch> retained_batches; //one per text_block
+  unsigned retained_generation; //of the buffer retained_vao points to
+  GLuint indirect_buffer;
+  std::vector<draw_command> retained_draws; //text_blocks drawn this frame
+
+  //runs of immediate text, of text_blocks and of text_blocks drawn from
+  //their paragraph texture, font::render draws them in the order they
+  //were added
+  enum draw_kind
+  {
+    DRAW_IMMEDIATE, DRAW_RETAINED, DRAW_PARAGRAPHS
+  };
+
+  struct draw_span
+  {
+    draw_kind kind;
+    size_t begin, end; //glyph_stream instances, retained_draws or cached_draws
+  };
+
+  std::vector<draw_span> draw_order;
+  GLuint glyph_ssbo; //font_data on the gpu
+  size_t glyph_ssbo_size;
+  size_t dirty_begin, dirty_end; //font_data range changed since the last upload
+  GLuint style_ubo;
+  std::vector<sdf_style> styles;
+  bool styles_dirty;
+  GLuint effect_ubo;
+  std::vector<text_effect> effects;
+  bool effects_dirty;
   std::vector<fontscalebias> font_data;
+  std::vector<unsigned> free_font_data;
   GLuint the_shader; //shader program
   bool is_set_up;
   std::vector<font_inst*> instances;
+  std::vector<shared_face*> shared_faces; //one per font file
+  glyph_rasterizer* rasterizer; //freetype worker threads
+  GLuint pbo; //staging for the glyph bitmaps of one frame
+  size_t pbo_size;
+  unsigned glyph_arrivals; //glyphs added to the atlas so far
+  unsigned glyph_evictions; //glyphs removed from the atlas so far
+  GLuint cached_shader; //draws the paragraph textures
+  GLuint cache_fbo; //renders into them
+  std::vector<text_block*> cached_blocks; //every block with a paragraph texture
+  std::vector<text_block*> cache_bakes; //rendered into their texture this frame
+  std::vector<text_block*> cached_draws; //drawn as one quad this frame, 0 if released since
+  size_t cache_bytes, cache_budget;
 
-  void delete_glyphs();
+  bool allocate_glyph( unsigned w, unsigned h, atlas_allocator::rect& r );
+  void evict_glyph( font_inst* f, unsigned size, uint32_t codepoint );
+  shared_face* acquire_face( const std::string& filename, unsigned int index );
+  void release_face( shared_face* sf );
+  void request_glyph( font_inst& f, uint32_t codepoint );
+  void request_glyph( font_inst& f, unsigned glyph_size, uint32_t codepoint );
+  //empties the failed glyphs of f if something was evicted since
+  void forget_failed_glyphs( font_inst& f );
+  void integrate_glyphs( bool wait );
+  void upload_glyphs( std::vector<rasterized_glyph>& done );
+  glyph& insert_glyph( font_inst* f, unsigned size, uint32_t codepoint, const atlas_allocator::rect& r, int width, int rows, int left, int top, float advance, unsigned glyphid );
 
   void* get_library()
   {
@@ -62,19 +287,19 @@ private:
     return the_shader;  //load shader externally
   }
 
-  mm::uvec2 get_texsize()
+  GLuint& get_cached_shader()
   {
-    return texsize;
+    return cached_shader;
   }
 
-  mm::uvec2& get_texture_pen()
+  mm::uvec2 get_texsize()
   {
-    return texture_pen;
+    return texsize;
   }
 
-  GLint& get_tex_row_h()
+  unsigned get_frame()
   {
-    return texture_row_h;
+    return frame;
   }
 
   GLuint get_tex()
@@ -82,16 +307,6 @@ private:
     return tex;
   }
 
-  size_t get_font_data_size()
-  {
-    return font_data.size();
-  }
-
-  fontscalebias& get_font_data( size_t i )
-  {
-    return font_data[i];
-  }
-
   void set_up();
   void destroy();
 
@@ -116,20 +331,122 @@ private:
     glBindVertexArray( vao );
   }
 
-  template< class t >
-  void update_scalebiascolor( unsigned int i, const std::vector< t >& tt )
+  void bind_styles()
+  {
+    if( styles_dirty )
+    {
+      glBindBuffer( GL_UNIFORM_BUFFER, style_ubo );
+      glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof( sdf_style ) * styles.size(), &styles[0] );
+      glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+      styles_dirty = false;
+    }
+
+    glBindBufferBase( GL_UNIFORM_BUFFER, 0, style_ubo );
+  }
+
+  void bind_effects()
+  {
+    if( effects_dirty )
+    {
+      glBindBuffer( GL_UNIFORM_BUFFER, effect_ubo );
+      glBufferSubData( GL_UNIFORM_BUFFER, 0, sizeof( text_effect ) * effects.size(), &effects[0] );
+      glBindBuffer( GL_UNIFORM_BUFFER, 0 );
+      effects_dirty = false;
+    }
+
+    glBindBufferBase( GL_UNIFORM_BUFFER, 1, effect_ubo );
+  }
+
+  //extends the last span if it's the same kind and ends at begin
+  void add_draw( draw_kind kind, size_t begin, size_t end )
   {
-    glBindBuffer( GL_ARRAY_BUFFER, vbos[i] );
+    if( begin == end )
+      return;
 
-    if( tt.size() > 0 )
-      glBufferData( GL_ARRAY_BUFFER, sizeof(t)* tt.size(), &tt[0], GL_DYNAMIC_DRAW );
+    if( !draw_order.empty() && draw_order.back().kind == kind && draw_order.back().end == begin )
+    {
+      draw_order.back().end = end;
+      return;
+    }
+
+    draw_span s = { kind, begin, end };
+    draw_order.push_back( s );
+  }
+
+  void release_paragraph( text_block* b );
+  void bake_paragraphs();
+  //cached_draws from begin to end, switches to the cached shader and back
+  void draw_paragraphs( const mm::mat4& mvp, size_t begin, size_t end );
+
+  void set_up_vao( GLuint& v );
+  void bind_instance_attributes( GLuint buffer );
+  void bind_glyph_data();
+
+  unsigned add_batch( const mm::mat4& transform, const mm::vec4& color, const mm::vec4& highlight_color, float filter, float scale, unsigned style, const mm::vec4& clip, unsigned effect, float effect_start )
+  {
+    unsigned idx = batch_stream.size();
+
+    glyph_batch& b = batch_stream.push();
+    b.transform = transform;
+    b.color = color;
+    b.highlight_color = highlight_color;
+    b.filter = filter;
+    b.scale = scale;
+    b.style = style;
+    b.effect = effect;
+    b.clip = clip;
+    b.effect_start = effect_start;
+    b.padding[0] = b.padding[1] = b.padding[2] = 0;
+
+    return idx;
+  }
+
+  //layout output of immediate text, see text_block for retained text
+  void add_instance( const mm::vec2& pos, unsigned glyph, unsigned batch, unsigned character )
+  {
+    glyph_stream.push() = make_glyph_instance( pos, glyph, batch, character );
+  }
+
+  void add_decoration( const mm::vec2& pos, const mm::vec2& size, unsigned white_glyph, unsigned batch, unsigned flags )
+  {
+    glyph_stream.push() = make_decoration_instance( pos, size, white_glyph, batch, flags );
   }
 
   bool expand_tex();
 
-  void add_font_data( const fontscalebias& fd )
+  unsigned add_font_data( const fontscalebias& fd )
+  {
+    unsigned i;
+
+    if( !free_font_data.empty() )
+    {
+      i = free_font_data.back();
+      free_font_data.pop_back();
+      font_data[i] = fd;
+    }
+    else
+    {
+      font_data.push_back( fd );
+      i = font_data.size() - 1;
+    }
+
+    if( dirty_begin == dirty_end )
+    {
+      dirty_begin = i;
+      dirty_end = i + 1;
+    }
+    else
+    {
+      dirty_begin = std::min( dirty_begin, (size_t)i );
+      dirty_end = std::max( dirty_end, (size_t)i + 1 );
+    }
+
+    return i;
+  }
+
+  void remove_font_data( unsigned i )
   {
-    font_data.push_back( fd );
+    free_font_data.push_back( i );
   }
 protected:
   library(); //singleton
@@ -165,27 +482,69 @@ public:
     friend class library;
   private:
     unsigned int size;
-    float asc;
-    float desc;
-    float h;
-    float gap;
-    float upos;
-    float uthick;
-    void* the_face; //FT_Face
-    std::map< unsigned int, std::map<uint32_t, glyph> >* glyphs;
+    bool sdf; //one rasterization for every size
+    shared_face* shared; //mapped file and FT_Face, shared with other font_insts
+
+    //line metrics of one pixel size, in pixels
+    struct size_metrics
+    {
+      unsigned size;
+      float asc, desc, h, gap, upos, uthick;
+    };
+
+    size_metrics current; //of size
+    std::vector<size_metrics> sizes; //every size set so far, recorded text reads them
+    void* the_face; //FT_Face, of shared
+    glyph_table<glyph>* glyphs;
+    glyph_table<char>* requested; //queued for rasterization
+    glyph_table<char>* failed; //didn't fit in the full atlas, not requested again until an eviction
+    unsigned failed_evictions; //library::glyph_evictions when failed was last emptied
+    kerning_cache* kerning_data; //of the current glyph size
+    std::vector<kerning_cache*> kerning_caches;
+    digit_table* digits; //for text_block::set_number, rebuilt when the atlas changes
 
     void set_size( unsigned int val );
-    bool load_glyph( uint32_t val );
+    void set_kerning_cache();
+    void build_kerning();
+    void activate_glyph_size();
 
     unsigned int get_size()
     {
       return size;
     }
 
+    //size the glyphs are rasterized and stored at
+    unsigned int glyph_size();
+
+    //stored glyph metrics * glyph_scale = metrics at the current size
+    float glyph_scale();
+
+    //the face at one pixel size, what the layout reads
+    //only looks things up, so text_commands can record at a size that
+    //isn't the current one while the render thread changes it
+    struct sized
+    {
+      face* f;
+      const size_metrics* m; //0 if the size was never set
+      kerning_cache* kern;
+      unsigned glyph_size;
+      float scale;
+
+      glyph* find( uint32_t c );
+      float advance( const uint32_t current );
+      //pairs that were never looked up on the render thread give 0
+      float cached_kerning( const uint32_t prev, const uint32_t next );
+    };
+
+    sized current_size();
+    sized at_size( unsigned s );
+
     glyph& get_glyph( uint32_t i );
     bool has_glyph( uint32_t i );
     float advance( const uint32_t current );
     float kerning( const uint32_t prev, const uint32_t next = 0 );
+    //read only, pairs that were never looked up on the render thread give 0
+    float cached_kerning( const uint32_t prev, const uint32_t next );
     float height();
     float linegap();
     float ascender();
@@ -195,7 +554,7 @@ public:
   protected:
   public:
     face();
-    face( const std::string& filename, unsigned int index = 0 );
+    face( const std::string& filename, unsigned int index = 0, bool is_sdf = false );
     ~face();
   }*the_face;
 
@@ -208,31 +567,582 @@ public:
   }
 };
 
+//a string laid out once and kept on the gpu
+//pass it to font::add_to_render_list every frame it should be drawn,
+//transform, colors and filter only patch the block's batch,
+//the layout is redone when the text, font, size or line height changes,
+//or when one of its glyphs was evicted from the atlas
+class text_block
+{
+  friend class font;
+  friend class library;
+private:
+  std::string text; //utf-8
+  font_inst* f;
+  unsigned size;
+  float line_height;
+  unsigned sdf_style_id;
+  glyph_batch batch;
+  std::vector<glyph_instance> instances;
+  std::vector< std::pair<uint32_t, unsigned> > used_glyphs; //codepoint, font_data index at layout time
+  size_t range_offset, range_size; //in the retained instance buffer
+  size_t range_capacity; //allocated, with room for the text to grow
+  unsigned batch_slot; //in the retained batch buffer, ~0u if none yet
+  unsigned layout_screen_height; //positions are laid out in screen space
+  mm::vec2 extent;
+  mm::vec2 bounds_min, bounds_max; //of the glyph origins + biases
+  mm::vec2 max_quad; //biggest glyph quad, bounds and this cover every quad
+  bool needs_layout;
+  bool needs_batch_update;
+  bool incomplete; //laid out while some glyphs were still rasterizing
+  unsigned glyph_arrivals; //library::glyph_arrivals at layout time
+  bool numeric; //text came from set_number, laid out from the digit table
+  float wrap_width; //see set_wrap
+  unsigned align;
+  float layout_wrap_width; //wrap_width in pixels at layout time
+
+  //a change is laid out again from the start of its line, the lines
+  //before it keep their instances
+  struct line_start
+  {
+    unsigned offset; //first byte in text
+    unsigned instance; //first instance
+    unsigned markup; //decorations turned on before the line, a bit each
+    unsigned character; //index of its first character, markup doesn't count
+  };
+
+  std::vector<line_start> line_starts; //of the last layout
+  size_t changed_from; //first byte that differs from the last layout, 0 for all, ~0 for none
+  bool cached; //drawn from a paragraph texture, see set_cached
+  bool cache_valid; //the texture shows the current layout and style
+  GLuint cache_tex;
+  mm::vec2 cache_origin; //of the texture, in laid out pixels
+  mm::uvec2 cache_size;
+  unsigned cache_last_used; //frame
+  bool hit_testable; //keeps hits, see set_hit_testable
+  hit_cells hits;
+
+  //the line a layout starts again at, 0 lays out everything
+  unsigned changed_line() const
+  {
+    if( changed_from == 0 || line_starts.empty() )
+      return 0;
+
+    auto it = std::upper_bound( line_starts.begin(), line_starts.end(), changed_from,
+                                []( size_t o, const line_start & l )
+    {
+      return o < l.offset;
+    } );
+
+    unsigned l = unsigned( it - line_starts.begin() ) - 1;
+
+    //a shorter first word may fit on the line before now
+    if( layout_wrap_width > 0 && l > 0 )
+      --l;
+
+    return l;
+  }
+
+  void set_digits( const char* d, size_t n )
+  {
+    if( !numeric || n != text.size() || std::memcmp( d, text.data(), n ) != 0 )
+    {
+      text.assign( d, n );
+      numeric = true;
+      needs_layout = true;
+      changed_from = 0;
+    }
+  }
+
+  //layout output, same interface as the library's immediate path
+  void add_instance( const mm::vec2& pos, unsigned glyph, unsigned b, unsigned character )
+  {
+    instances.push_back( make_glyph_instance( pos, glyph, b, character ) );
+  }
+
+  void add_decoration( const mm::vec2& pos, const mm::vec2& s, unsigned white_glyph, unsigned b, unsigned flags )
+  {
+    instances.push_back( make_decoration_instance( pos, s, white_glyph, b, flags ) );
+  }
+
+  text_block( const text_block& );
+  text_block& operator=( const text_block& );
+protected:
+public:
+  void set_text( const utf8_view& t )
+  {
+    size_t n = std::min( t.size, text.size() );
+    size_t same = 0;
+
+    while( same < n && t.data[same] == text[same] )
+      ++same;
+
+    if( numeric || same != t.size || t.size != text.size() )
+    {
+      text.assign( t.data, t.size );
+      changed_from = numeric ? 0 : std::min( changed_from, same );
+      numeric = false;
+      needs_layout = true;
+    }
+  }
+
+  void set_text( const std::wstring& t )
+  {
+    std::string s;
+    utf8_append( t, s );
+    set_text( utf8_view( s ) );
+  }
+
+  void set_font( font_inst& font_ptr, unsigned s, float lh = 1 )
+  {
+    if( &font_ptr != f || s != size || lh != line_height )
+    {
+      f = &font_ptr;
+      size = s;
+      line_height = lh;
+      needs_layout = true;
+      changed_from = 0;
+    }
+  }
+
+  //lines longer than width are broken before the word that doesn't fit,
+  //words longer than a line are broken anywhere, width is in pixels,
+  //0 doesn't wrap, a negative width is that much less than the window
+  //width, so it follows resizes, align is a FONT_ALIGN_*
+  void set_wrap( float width, unsigned a = FONT_ALIGN_LEFT )
+  {
+    if( width != wrap_width || a != align )
+    {
+      wrap_width = width;
+      align = a;
+      needs_layout = true;
+      changed_from = 0;
+    }
+  }
+
+  void set_transform( const mm::mat4& m )
+  {
+    batch.transform = m;
+    needs_batch_update = true;
+  }
+
+  void set_color( const mm::vec4& c )
+  {
+    batch.color = c;
+    needs_batch_update = true;
+    cache_valid = false;
+  }
+
+  void set_highlight_color( const mm::vec4& c )
+  {
+    batch.highlight_color = c;
+    needs_batch_update = true;
+    cache_valid = false;
+  }
+
+  void set_filter( float filter )
+  {
+    batch.filter = filter;
+    needs_batch_update = true;
+    cache_valid = false;
+  }
+
+  void set_sdf_style( unsigned id )
+  {
+    sdf_style_id = id;
+    needs_batch_update = true;
+    cache_valid = false;
+  }
+
+  //id from font::add_text_effect, 0 turns it off, start is the font time
+  //the first character starts at, see font::get_time
+  //decorations aren't animated, see text_effect
+  //animated blocks are never drawn from a paragraph texture
+  void set_effect( unsigned id, float start )
+  {
+    batch.effect = id;
+    batch.effect_start = start;
+    needs_batch_update = true;
+  }
+
+  //long static text is rendered once into a texture and drawn as one
+  //quad until its text, font or style changes, the transform only moves
+  //the quad, while it rotates or scales, or has a text effect, the block
+  //is drawn glyph by glyph as usual
+  //textures are dropped least recently used first over the budget,
+  //see font::set_paragraph_cache_budget
+  void set_cached( bool c )
+  {
+    cached = c;
+  }
+
+  //the layout keeps where each character is, so font::hit_test can
+  //find the block and character under the mouse
+  void set_hit_testable( bool h )
+  {
+    if( h && !hit_testable )
+    {
+      needs_layout = true;
+      changed_from = 0;
+    }
+
+    hit_testable = h;
+
+    if( !h )
+      hits.clear();
+  }
+
+  //byte range of the word around offset in get_text(), words end at
+  //spaces, newlines and markup
+  void get_word( size_t offset, size_t& begin, size_t& end );
+
+  //hud counters, the value is formatted on the stack and laid out from
+  //the font's digits only, an unchanged value keeps its instances
+  void set_number( long long v );
+  //fixed point, rounded to decimals digits after the point
+  void set_number( double v, unsigned decimals );
+
+  const std::string& get_text()
+  {
+    return text;
+  }
+
+  //same as the return value of the immediate add_to_render_list,
+  //valid once the block has been added to the render list
+  mm::vec2 get_extent()
+  {
+    return extent;
+  }
+
+  text_block();
+  ~text_block();
+};
+
+//any number of readers or one writer, writers go first once they wait
+//there's only one writing thread, so its lock nests: font's calls
+//lock it and still call each other
+class read_write_lock
+{
+private:
+  std::mutex m;
+  std::condition_variable changed;
+  unsigned readers;
+  unsigned writers_waiting;
+  bool writing;
+  unsigned depth; //nested locks of the writer, only it touches this
+
+  read_write_lock( const read_write_lock& );
+  read_write_lock& operator=( const read_write_lock& );
+protected:
+public:
+  void lock_shared()
+  {
+    std::unique_lock<std::mutex> l( m );
+    changed.wait( l, [&]()
+    {
+      return !writing && !writers_waiting;
+    } );
+    ++readers;
+  }
+
+  void unlock_shared()
+  {
+    std::lock_guard<std::mutex> l( m );
+
+    if( --readers == 0 )
+      changed.notify_all();
+  }
+
+  void lock()
+  {
+    if( depth++ )
+      return;
+
+    std::unique_lock<std::mutex> l( m );
+    ++writers_waiting;
+    changed.wait( l, [&]()
+    {
+      return !writing && !readers;
+    } );
+    --writers_waiting;
+    writing = true;
+  }
+
+  void unlock()
+  {
+    if( --depth )
+      return;
+
+    std::lock_guard<std::mutex> l( m );
+    writing = false;
+    changed.notify_all();
+  }
+
+  //for the readers, the writer uses std::lock_guard
+  struct shared_guard
+  {
+    read_write_lock& l;
+
+    shared_guard( read_write_lock& rw ) : l( rw )
+    {
+      l.lock_shared();
+    }
+
+    ~shared_guard()
+    {
+      l.unlock_shared();
+    }
+  };
+
+  read_write_lock() : readers( 0 ), writers_waiting( 0 ), writing( false ), depth( 0 )
+  {
+  }
+};
+
+//immediate text recorded on another thread
+//each thread fills its own buffer, font::render merges all of them in
+//ascending order (equal orders in the order the buffers were created)
+//recording only reads the glyph cache, threads record at the same time,
+//while the render thread's calls into font that change the cache wait
+//for the add_to_render_list calls in progress and hold off new ones,
+//a buffer gets into a frame with the calls that finished before the
+//merge, recorded text doesn't read the current size of the font,
+//glyphs that aren't in the cache yet are skipped and requested at the merge
+//fonts mustn't be loaded or deleted while they are recorded with
+class text_commands
+{
+  friend class font;
+  template< class t > friend struct culling_sink;
+private:
+  unsigned order;
+  std::vector<glyph_batch> batches;
+  std::vector<glyph_instance> instances;
+  std::vector< std::tuple<font_inst*, unsigned, uint32_t> > used_glyphs; //glyph size, codepoint, touched or requested at the merge
+  std::vector< std::pair<font_inst*, unsigned> > unprepared_sizes; //never set, so nothing was recorded, set at the merge
+  std::vector<placed_glyph> layout_glyphs;
+  std::vector< std::pair<mm::vec4, unsigned> > layout_decorations; //pos, size, flags
+  std::vector<mm::vec4> clip_stack; //min xy, max xy in window pixels
+  std::string utf8_scratch; //wstring input converted to utf-8 for the layout, reused
+  unsigned effect; //see set_effect
+  float effect_start;
+
+  mm::vec4 current_clip();
+
+  //layout output
+  void add_instance( const mm::vec2& pos, unsigned glyph, unsigned b, unsigned character )
+  {
+    instances.push_back( make_glyph_instance( pos, glyph, b, character ) );
+  }
+
+  void add_decoration( const mm::vec2& pos, const mm::vec2& s, unsigned white_glyph, unsigned b, unsigned flags )
+  {
+    instances.push_back( make_decoration_instance( pos, s, white_glyph, b, flags ) );
+  }
+
+  text_commands( const text_commands& );
+  text_commands& operator=( const text_commands& );
+protected:
+public:
+  //same as font::add_to_render_list, at the pixel size given here, the
+  //size the render thread set on the font doesn't matter
+  //a size font::set_size never got records nothing until it was
+  //prepared by a merge, usually the next frame
+  mm::vec2 add_to_render_list( const utf8_view& text, font_inst& font_ptr, unsigned size, const mm::vec4& color = mm::vec4( 1 ), const mm::mat4& mat = mm::mat4::identity, const mm::vec4& highlight_color = mm::vec4( 1 ), float line_height = 1, float filter = 0, unsigned sdf_style_id = 0, float max_width = 0, unsigned align = FONT_ALIGN_LEFT );
+  mm::vec2 add_to_render_list( const std::wstring& text, font_inst& font_ptr, unsigned size, const mm::vec4& color = mm::vec4( 1 ), const mm::mat4& mat = mm::mat4::identity, const mm::vec4& highlight_color = mm::vec4( 1 ), float line_height = 1, float filter = 0, unsigned sdf_style_id = 0, float max_width = 0, unsigned align = FONT_ALIGN_LEFT );
+  void push_clip_rect( const mm::vec4& rect );
+  void pop_clip_rect();
+
+  //same as font::set_effect, start is in the font time of the merge
+  void set_effect( unsigned id, float start = 0 )
+  {
+    effect = id;
+    effect_start = start;
+  }
+
+  text_commands( unsigned o = 0 );
+  ~text_commands();
+};
+
 class font
 {
+  friend class text_commands;
+  friend class text_block;
 private:
   mm::uvec2 screensize;
   mm::frame<float> font_frame;
+  bool blocking_glyph_loads;
+  std::vector<mm::vec4> clip_stack; //min xy, max xy in window pixels
+  float time; //seconds, drives the text effects, see set_time
+  unsigned effect; //of the immediate text, see set_effect
+  float effect_start;
+  std::vector<placed_glyph> layout_glyphs;
+  std::vector< std::pair<mm::vec4, unsigned> > layout_decorations; //pos, size, flags
+  std::string cache_dir; //baked atlas caches, empty if off
+  std::string utf8_scratch; //wstring input converted to utf-8 for the layout, reused
+  std::vector<text_commands*> command_buffers; //sorted by order
+  read_write_lock cache_lock; //shared while recording, held by the render thread's calls that change the glyph cache
+
+  //hit testable blocks drawn this frame and the last one, queries go to
+  //the last one, that is what's on screen
+  struct hit_entry
+  {
+    text_block* block;
+    mm::vec2 translation; //of the block's transform when it was drawn
+    mm::vec4 rect; //min xy, max xy in window pixels, clipped
+  };
+
+  std::vector<hit_entry> hit_blocks, shown_hit_blocks;
+  //uniform grid over the screen, built on the first query of a frame
+  hit_grid shown_hit_grid; //of shown_hit_blocks
+  bool hit_grid_dirty;
+
+  void build_hit_grid();
+  void forget_block( text_block* b );
+  std::mutex command_buffers_mutex;
+
+  bool add_glyph( font_inst& f, uint32_t c );
+  bool add_glyph( font_inst& f, unsigned glyph_size, uint32_t c );
+  bool load_baked_glyphs( font_inst& f );
+
+  //the innermost clip rect, or the screen
+  mm::vec4 current_clip();
+  //rect in x, y, w, h from the top left, cut to top
+  mm::vec4 clip_rect( const mm::vec4& rect, const mm::vec4& top );
+
+  //text_commands::add_to_render_list, on the recording thread
+  mm::vec2 record( text_commands& c, const utf8_view& text, font_inst& font_ptr, unsigned size, const mm::vec4& color, const mm::mat4& mat, const mm::vec4& highlight_color, float line_height, float filter, unsigned sdf_style_id, float max_width, unsigned align );
+  //true if the block is drawn from its paragraph texture this frame
+  bool cache_paragraph( text_block& b );
+  //add_to_render_list of a text_block, with its size set
+  void draw_block( text_block& b );
 
-  void add_glyph( font_inst& f, uint32_t c, int counter = 0 );
+  //the text_commands of every thread go after the immediate text
+  void merge_command_buffers();
+
+  //text_block::set_number text, advances only, digits don't kern
+  mm::vec2 layout_number( text_block& b, font_inst& font_ptr );
+
+  //on the render thread (rec = 0) glyphs are loaded or touched,
+  //when recording they are only looked up, rec keeps the rest
+  bool use_glyph( font_inst& f, unsigned glyph_size, uint32_t c, text_commands* rec );
+
+  //pixel_size is the current size of the font on the render thread,
+  //the size of the text_commands call when recording
+  //block is the text_block being laid out, it keeps its line starts and
+  //hits, and the layout starts at its changed line
+  //lines are wrapped at max_width when it's not 0, size gets the widest
+  //line and the height of all lines
+  template< class t >
+  mm::vec2 layout( const utf8_view& text, font_inst& font_ptr, unsigned pixel_size, float line_height, float max_width, unsigned align, unsigned batch, text_commands* rec, t& out, text_block* block = 0, mm::vec2* size = 0 );
 protected:
-  font()
+  font() : blocking_glyph_loads( false ), time( 0 ), effect( 0 ), effect_start( 0 ), hit_grid_dirty( true )
   {
   } //singleton
   font( const font& );
   font( font && );
   font& operator=( const font& );
 public:
-  void load_font( const std::string& filename, font_inst& font_ptr, unsigned int size );
-  mm::vec2 add_to_render_list( const std::wstring& text, font_inst& font_ptr, const mm::vec4& color = mm::vec4( 1 ), const mm::mat4& mat = mm::mat4::identity, const mm::vec4& highlight_color = mm::vec4( 1 ), float line_height = 1, float filter = 0 );
+  //sdf fonts rasterize every glyph once and scale it to any size,
+  //bitmap fonts stay crisper for small ui text
+  void load_font( const std::string& filename, font_inst& font_ptr, unsigned int size, bool sdf = false );
+  //utf-8 text is laid out straight from the caller's memory
+  mm::vec2 add_to_render_list( const utf8_view& text, font_inst& font_ptr, const mm::vec4& color = mm::vec4( 1 ), const mm::mat4& mat = mm::mat4::identity, const mm::vec4& highlight_color = mm::vec4( 1 ), float line_height = 1, float filter = 0, unsigned sdf_style_id = 0, float max_width = 0, unsigned align = FONT_ALIGN_LEFT );
+  mm::vec2 add_to_render_list( const std::wstring& text, font_inst& font_ptr, const mm::vec4& color = mm::vec4( 1 ), const mm::mat4& mat = mm::mat4::identity, const mm::vec4& highlight_color = mm::vec4( 1 ), float line_height = 1, float filter = 0, unsigned sdf_style_id = 0, float max_width = 0, unsigned align = FONT_ALIGN_LEFT );
+  //text added while a clip rect is pushed is cut to it, nested rects
+  //intersect, glyphs entirely outside are dropped before the gpu sees them
+  //x, y, w, h in pixels from the top left of the screen
+  void push_clip_rect( const mm::vec4& rect );
+  void pop_clip_rect();
+
+  //immediate text added after this is animated by the text effect id,
+  //0 turns it off, start is the font time the first character starts at
+  //decorations aren't animated, see text_effect
+  void set_effect( unsigned id, float start = 0 )
+  {
+    effect = id;
+    effect_start = start;
+  }
+
+  //the clock of the text effects in seconds, set once a frame, the
+  //effects are evaluated on the gpu from it
+  void set_time( float t )
+  {
+    time = t;
+  }
+
+  float get_time()
+  {
+    return time;
+  }
+
+  //size of the text as add_to_render_list would lay it out, the widest
+  //line by the height of the lines, nothing is drawn
+  //glyphs that haven't arrived yet count as nothing, same as when drawing
+  mm::vec2 measure( const utf8_view& text, font_inst& font_ptr, float line_height = 1, float max_width = 0 );
+
+  //draws a retained text_block this frame, laying it out only if needed
+  //blocks and immediate text are drawn in the order they were added,
+  //text recorded into text_commands goes after both
+  void add_to_render_list( text_block& block );
+
+  //the hit testable text_block drawn last frame under pos, in pixels from
+  //the top left of the screen, and the byte offset of the character there
+  //in its get_text(), false if there's none
+  bool hit_test( const mm::vec2& pos, text_block*& block, size_t& offset );
   void render();
 
   void set_size( font_inst& f, unsigned int s );
 
+  //distance between two rows of text
+  float line_advance( font_inst& f, unsigned int size, float line_height = 1 );
+
+  //glyphs are rasterized on worker threads, text skips the ones that
+  //haven't arrived yet, unless blocking loads are turned on
+  void set_blocking_glyph_loads( bool b )
+  {
+    blocking_glyph_loads = b;
+  }
+
+  //prewarmed glyphs, their metrics and kerning are read from baked
+  //cache files in dir when there's one for the font file, size and mode
+  void set_cache_dir( const std::string& dir )
+  {
+    cache_dir = dir;
+  }
+
+  //offline: rasterizes the prewarmed glyphs with freetype
+  //and writes the cache file set_cache_dir looks for
+  bool bake_font_cache( const std::string& filename, unsigned int size, bool sdf = false );
+
+  //waits for every queued glyph and puts it into the atlas
+  void finish_glyph_loads()
+  {
+    std::lock_guard<read_write_lock> lock( cache_lock );
+    library::get().integrate_glyphs( true );
+  }
+
   void resize( const mm::uvec2& ss );
 
+  //memory for the textures of text_block::set_cached, in bytes
+  void set_paragraph_cache_budget( size_t bytes );
+
+  //returns the id to pass to add_to_render_list, 0 is the default style
+  unsigned add_sdf_style( const sdf_style& s );
+  void set_sdf_style( unsigned id, const sdf_style& s );
+
+  //returns the id to pass to set_effect, 0 is no effect
+  unsigned add_text_effect( const text_effect& e );
+  void set_text_effect( unsigned id, const text_effect& e );
+
+  //stats of the last rendered frame
+  atlas_stats get_atlas_stats()
+  {
+    return library::get().last_frame_stats;
+  }
+
   void destroy()
   {
+    std::lock_guard<read_write_lock> lock( cache_lock );
     library::get().destroy();
   }
 
@@ -241,6 +1151,11 @@ public:
     return library::get().get_shader();
   }
 
+  GLuint& get_cached_shader()
+  {
+    return library::get().get_cached_shader();
+  }
+
   static font& get()
   {
     static font instance;
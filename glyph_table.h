@@ -0,0 +1,194 @@
+#ifndef glyph_table_h
+#define glyph_table_h
+
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+//flat open-addressing hash table keyed by (pixel size, codepoint)
+//linear probing over a power of two sized slot array,
+//so a lookup is a multiply, a mask and usually one cache line
+template< class t >
+class glyph_table
+{
+private:
+  struct slot
+  {
+    uint64_t key;
+    t value;
+  };
+
+  std::vector<slot> slots;
+  size_t num_elements;
+  size_t mask;
+  std::vector<unsigned> prewarmed_sizes;
+
+  static uint64_t empty_key()
+  {
+    return ~uint64_t( 0 );
+  }
+
+  static uint64_t make_key( unsigned size, uint32_t codepoint )
+  {
+    return ( uint64_t( size ) << 32 ) | codepoint;
+  }
+
+  size_t home_slot( uint64_t key ) const
+  {
+    //fibonacci hashing, neighbouring codepoints land far apart
+    return size_t( ( key * 0x9E3779B97F4A7C15ull ) >> 32 ) & mask;
+  }
+
+  void rehash( size_t new_capacity )
+  {
+    std::vector<slot> old;
+    old.swap( slots );
+
+    slot empty;
+    empty.key = empty_key();
+    slots.assign( new_capacity, empty );
+    mask = new_capacity - 1;
+
+    for( auto& s : old )
+    {
+      if( s.key == empty_key() )
+        continue;
+
+      size_t i = home_slot( s.key );
+
+      while( slots[i].key != empty_key() )
+        i = ( i + 1 ) & mask;
+
+      slots[i] = s;
+    }
+  }
+
+  size_t find_slot( uint64_t key ) const
+  {
+    for( size_t i = home_slot( key );; i = ( i + 1 ) & mask )
+    {
+      if( slots[i].key == key || slots[i].key == empty_key() )
+        return i;
+    }
+  }
+protected:
+public:
+  t* find( unsigned size, uint32_t codepoint )
+  {
+    if( num_elements == 0 )
+      return 0;
+
+    size_t i = find_slot( make_key( size, codepoint ) );
+
+    return slots[i].key == empty_key() ? 0 : &slots[i].value;
+  }
+
+  //returns the existing value or a default constructed new one
+  //NOTE: may rehash, invalidating previously returned pointers
+  t& insert( unsigned size, uint32_t codepoint )
+  {
+    t* v = find( size, codepoint );
+
+    if( v )
+      return *v;
+
+    //keep the load factor under 0.7
+    if( ( num_elements + 1 ) * 10 > slots.size() * 7 )
+      rehash( slots.size() * 2 );
+
+    uint64_t key = make_key( size, codepoint );
+    size_t i = home_slot( key );
+
+    while( slots[i].key != empty_key() )
+      i = ( i + 1 ) & mask;
+
+    slots[i].key = key;
+    slots[i].value = t();
+    ++num_elements;
+
+    return slots[i].value;
+  }
+
+  //backward shift deletion, no tombstones are left behind
+  //NOTE: moves other elements, invalidating previously returned pointers
+  void erase( unsigned size, uint32_t codepoint )
+  {
+    if( num_elements == 0 )
+      return;
+
+    size_t i = find_slot( make_key( size, codepoint ) );
+
+    if( slots[i].key == empty_key() )
+      return;
+
+    for( size_t j = ( i + 1 ) & mask; slots[j].key != empty_key(); j = ( j + 1 ) & mask )
+    {
+      size_t k = home_slot( slots[j].key );
+
+      //slot j can't move to i if its home lies cyclically in (i, j]
+      bool stays = i <= j ? ( i < k && k <= j ) : ( i < k || k <= j );
+
+      if( !stays )
+      {
+        slots[i] = slots[j];
+        i = j;
+      }
+    }
+
+    slots[i].key = empty_key();
+    --num_elements;
+  }
+
+  //f( size, codepoint, value )
+  template< class func >
+  void for_each( func f )
+  {
+    for( auto& s : slots )
+    {
+      if( s.key != empty_key() )
+        f( unsigned( s.key >> 32 ), uint32_t( s.key ), s.value );
+    }
+  }
+
+  void clear()
+  {
+    slot empty;
+    empty.key = empty_key();
+
+    for( auto& s : slots )
+      s = empty;
+
+    num_elements = 0;
+    prewarmed_sizes.clear();
+  }
+
+  size_t size() const
+  {
+    return num_elements;
+  }
+
+  //the whole cache string has been loaded for this size
+  bool is_prewarmed( unsigned size ) const
+  {
+    for( auto& s : prewarmed_sizes )
+    {
+      if( s == size )
+        return true;
+    }
+
+    return false;
+  }
+
+  void set_prewarmed( unsigned size )
+  {
+    if( !is_prewarmed( size ) )
+      prewarmed_sizes.push_back( size );
+  }
+
+  glyph_table() : num_elements( 0 ), mask( 0 )
+  {
+    rehash( 256 );
+  }
+};
+
+#endif
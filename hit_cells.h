@@ -0,0 +1,240 @@
+#ifndef hit_cells_h
+#define hit_cells_h
+
+#include "mymath/mymath.h"
+
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+//where the characters of a laid out text are, for mouse picking
+//lines go top to bottom and cells left to right within a line,
+//so a point query is two binary searches
+//a cell is the advance of a character by the height of its line,
+//the cells of a line tile it without gaps
+class hit_cells
+{
+private:
+  struct line
+  {
+    float y0, y1; //bottom, top
+    unsigned first, count; //cells
+  };
+
+  struct cell
+  {
+    float x0, x1;
+    unsigned offset; //first byte of the character in the text
+  };
+
+  std::vector<line> lines;
+  std::vector<cell> cells;
+  mm::vec2 bounds_min, bounds_max;
+protected:
+public:
+  void clear()
+  {
+    lines.clear();
+    cells.clear();
+    bounds_min = mm::vec2( FLT_MAX );
+    bounds_max = mm::vec2( -FLT_MAX );
+  }
+
+  //keeps the first n lines, the bounds only grow, they just have to
+  //contain the cells
+  void truncate( size_t n )
+  {
+    if( n >= lines.size() )
+      return;
+
+    cells.resize( lines[n].first );
+    lines.resize( n );
+  }
+
+  //moves the cells of the last line, for aligned text
+  void move_line( float dx )
+  {
+    if( lines.empty() )
+      return;
+
+    const line& l = lines.back();
+
+    for( unsigned i = l.first; i < l.first + l.count; ++i )
+    {
+      cells[i].x0 += dx;
+      cells[i].x1 += dx;
+    }
+
+    if( l.count )
+    {
+      bounds_min.x = std::min( bounds_min.x, cells[l.first].x0 );
+      bounds_max.x = std::max( bounds_max.x, cells[l.first + l.count - 1].x1 );
+    }
+  }
+
+  //moves every line, the text stays laid out when only the window height changes
+  void move( float dy )
+  {
+    for( auto& l : lines )
+    {
+      l.y0 += dy;
+      l.y1 += dy;
+    }
+
+    bounds_min.y += dy;
+    bounds_max.y += dy;
+  }
+
+  void add_line( float y0, float y1 )
+  {
+    line l = { y0, y1, unsigned( cells.size() ), 0 };
+    lines.push_back( l );
+  }
+
+  void add_cell( float x0, float x1, unsigned offset )
+  {
+    cell c = { x0, x1, offset };
+    cells.push_back( c );
+
+    line& l = lines.back();
+    ++l.count;
+
+    bounds_min = mm::vec2( std::min( bounds_min.x, x0 ), std::min( bounds_min.y, l.y0 ) );
+    bounds_max = mm::vec2( std::max( bounds_max.x, x1 ), std::max( bounds_max.y, l.y1 ) );
+  }
+
+  bool empty() const
+  {
+    return cells.empty();
+  }
+
+  mm::vec2 get_bounds_min() const
+  {
+    return bounds_min;
+  }
+
+  mm::vec2 get_bounds_max() const
+  {
+    return bounds_max;
+  }
+
+  //offset of the character under p, ~0u if there's none
+  unsigned find( const mm::vec2& p ) const
+  {
+    //the first line whose bottom is below p, y0 decreases down the lines
+    auto l = std::lower_bound( lines.begin(), lines.end(), p.y,
+                               []( const line & a, float y )
+    {
+      return a.y0 > y;
+    } );
+
+    if( l == lines.end() || p.y >= l->y1 )
+      return ~0u;
+
+    auto first = cells.begin() + l->first;
+    auto last = first + l->count;
+
+    auto c = std::upper_bound( first, last, p.x,
+                               []( float x, const cell & a )
+    {
+      return x < a.x0;
+    } );
+
+    if( c == first )
+      return ~0u;
+
+    --c;
+
+    return p.x < c->x1 ? c->offset : ~0u;
+  }
+
+  hit_cells() : bounds_min( FLT_MAX ), bounds_max( -FLT_MAX )
+  {
+  }
+};
+
+//uniform grid over the screen for the rects of hit testable texts,
+//every grid cell lists the rects that touch it
+class hit_grid
+{
+private:
+  std::vector<unsigned> start; //per grid cell, into items
+  std::vector<unsigned> items; //indices of the entries
+  mm::uvec2 size;
+  unsigned cell; //pixels
+
+  void cell_range( const mm::vec4& r, mm::uvec2& lo, mm::uvec2& hi ) const
+  {
+    lo = mm::uvec2( unsigned( std::max( r.x, 0.0f ) ) / cell, unsigned( std::max( r.y, 0.0f ) ) / cell );
+    hi = mm::uvec2( std::min( unsigned( std::max( r.z, 0.0f ) ) / cell, size.x - 1 ),
+                    std::min( unsigned( std::max( r.w, 0.0f ) ) / cell, size.y - 1 ) );
+  }
+protected:
+public:
+  //counting sort of the entries into the grid cells their rect touches,
+  //t has a rect, min xy, max xy in pixels
+  template< class t >
+  void build( const mm::uvec2& screen, unsigned cell_size, const std::vector<t>& entries )
+  {
+    cell = cell_size;
+    size = mm::uvec2( ( screen.x + cell - 1 ) / cell + 1, ( screen.y + cell - 1 ) / cell + 1 );
+
+    start.assign( size.x * size.y + 1, 0 );
+
+    for( auto& e : entries )
+    {
+      mm::uvec2 lo, hi;
+      cell_range( e.rect, lo, hi );
+
+      for( unsigned y = lo.y; y <= hi.y; ++y )
+        for( unsigned x = lo.x; x <= hi.x; ++x )
+          ++start[y * size.x + x + 1];
+    }
+
+    for( size_t c = 1; c < start.size(); ++c )
+      start[c] += start[c - 1];
+
+    items.resize( start.back() );
+    std::vector<unsigned> fill( start.begin(), start.end() - 1 );
+
+    for( unsigned i = 0; i < entries.size(); ++i )
+    {
+      mm::uvec2 lo, hi;
+      cell_range( entries[i].rect, lo, hi );
+
+      for( unsigned y = lo.y; y <= hi.y; ++y )
+        for( unsigned x = lo.x; x <= hi.x; ++x )
+          items[fill[y * size.x + x]++] = i;
+    }
+  }
+
+  //calls f with the index of every entry in the grid cell of p, the
+  //later entries first, until f returns true, false if none did
+  template< class t >
+  bool visit( const mm::vec2& p, const t& f ) const
+  {
+    if( p.x < 0 || p.y < 0 )
+      return false;
+
+    unsigned gx = unsigned( p.x ) / cell, gy = unsigned( p.y ) / cell;
+
+    if( gx >= size.x || gy >= size.y )
+      return false;
+
+    unsigned c = gy * size.x + gx;
+
+    for( unsigned i = start[c + 1]; i > start[c]; --i )
+    {
+      if( f( items[i - 1] ) )
+        return true;
+    }
+
+    return false;
+  }
+
+  hit_grid() : size( 0 ), cell( 1 )
+  {
+  }
+};
+
+#endif
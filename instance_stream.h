@@ -0,0 +1,182 @@
+#ifndef instance_stream_h
+#define instance_stream_h
+
+#include "GL/glew.h"
+
+#include <vector>
+#include <cstring>
+
+#define INSTANCE_STREAM_REGIONS 3
+
+//per frame instance data streamed through one persistently mapped buffer
+//the buffer is split into 3 regions, the cpu fills one while the gpu may
+//still read the other two, a fence per region guards against overwriting
+//data the gpu hasn't consumed yet
+//without ARB_buffer_storage it falls back to a cpu copy + glBufferSubData
+template< class t >
+class instance_stream
+{
+private:
+  GLuint buffer;
+  t* mapped;
+  std::vector<t> staging;
+  size_t capacity; //instances per region
+  size_t count; //written this frame
+  unsigned region;
+  bool region_ready;
+  unsigned generation; //changes whenever the buffer object does
+  GLsync fences[INSTANCE_STREAM_REGIONS];
+
+  static bool persistent()
+  {
+    return GLEW_ARB_buffer_storage != 0;
+  }
+
+  void wait( unsigned r )
+  {
+    if( !fences[r] )
+      return;
+
+    while( glClientWaitSync( fences[r], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000 ) == GL_TIMEOUT_EXPIRED )
+    {
+    }
+
+    glDeleteSync( fences[r] );
+    fences[r] = 0;
+  }
+
+  void allocate( size_t cap )
+  {
+    capacity = cap;
+    ++generation;
+
+    GLsizeiptr bytes = sizeof( t ) * capacity * INSTANCE_STREAM_REGIONS;
+
+    glGenBuffers( 1, &buffer );
+    glBindBuffer( GL_ARRAY_BUFFER, buffer );
+
+    if( persistent() )
+    {
+      GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage( GL_ARRAY_BUFFER, bytes, 0, flags );
+      mapped = (t*)glMapBufferRange( GL_ARRAY_BUFFER, 0, bytes, flags );
+    }
+    else
+    {
+      glBufferData( GL_ARRAY_BUFFER, bytes, 0, GL_STREAM_DRAW );
+      staging.resize( capacity * INSTANCE_STREAM_REGIONS );
+      mapped = &staging[0];
+    }
+  }
+
+  void release()
+  {
+    for( unsigned c = 0; c < INSTANCE_STREAM_REGIONS; ++c )
+      wait( c );
+
+    if( buffer )
+    {
+      if( persistent() )
+      {
+        glBindBuffer( GL_ARRAY_BUFFER, buffer );
+        glUnmapBuffer( GL_ARRAY_BUFFER );
+      }
+
+      glDeleteBuffers( 1, &buffer );
+    }
+
+    buffer = 0;
+    mapped = 0;
+  }
+
+  //the region is full: wait for the gpu and move to a twice as big buffer
+  //rare, the capacity settles at the biggest frame seen
+  void grow()
+  {
+    std::vector<t> written( mapped + region * capacity, mapped + region * capacity + count );
+
+    release();
+    allocate( capacity * 2 );
+
+    region = 0;
+    memcpy( mapped, &written[0], sizeof( t ) * count );
+  }
+protected:
+public:
+  void set_up( size_t cap )
+  {
+    if( !buffer )
+      allocate( cap );
+  }
+
+  void destroy()
+  {
+    release();
+  }
+
+  //write the returned instance directly, it is already in gpu visible memory
+  t& push()
+  {
+    if( !region_ready )
+    {
+      wait( region );
+      region_ready = true;
+    }
+
+    if( count == capacity )
+      grow();
+
+    return mapped[region * capacity + count++];
+  }
+
+  //before the draw call
+  void flush()
+  {
+    if( !persistent() && count > 0 )
+    {
+      glBindBuffer( GL_ARRAY_BUFFER, buffer );
+      glBufferSubData( GL_ARRAY_BUFFER, sizeof( t ) * region * capacity, sizeof( t ) * count, mapped + region * capacity );
+    }
+  }
+
+  //after the draw call that consumed this frame's instances
+  void finish_frame()
+  {
+    if( region_ready )
+    {
+      fences[region] = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+      region = ( region + 1 ) % INSTANCE_STREAM_REGIONS;
+    }
+
+    region_ready = false;
+    count = 0;
+  }
+
+  GLuint get_buffer()
+  {
+    return buffer;
+  }
+
+  unsigned get_generation()
+  {
+    return generation;
+  }
+
+  GLuint base_instance()
+  {
+    return region * capacity;
+  }
+
+  size_t size()
+  {
+    return count;
+  }
+
+  instance_stream() : buffer( 0 ), mapped( 0 ), capacity( 0 ), count( 0 ), region( 0 ), region_ready( false ), generation( 0 )
+  {
+    for( unsigned c = 0; c < INSTANCE_STREAM_REGIONS; ++c )
+      fences[c] = 0;
+  }
+};
+
+#endif
@@ -2,15 +2,13 @@
 
 #include "browser.h"
 #include "font.h"
-#include "animation.h"
+#include "animation_batch.h"
 #include "transition.h"
 #include "post_process.h"
 
 #include <sstream>
 #include <string>
 #include <iostream>
-#include <locale>
-#include <codecvt>
 
 namespace js
 {
@@ -26,9 +24,9 @@ namespace js
 void browser::onTitleChanged( Berkelium::Window* win,
                               Berkelium::WideString title )
 {
-  std::wstring_convert<std::codecvt_utf8_utf16<wchar_t>> conv;
-  std::wstring str( title.mData, title.mLength );
-  frm.set_title( conv.to_bytes( str ) );
+  std::string str;
+  utf8_append( title.mData, title.mLength, str );
+  frm.set_title( str );
 }
 
 template< class t >
@@ -63,6 +61,16 @@ void visualize( t f, const vec3& color = vec3( 1 ) )
 
 int main( int argc, char** args )
 {
+  font::get().set_cache_dir( "../resources/fontcache/" );
+
+  //offline: bake the atlas caches of the fonts loaded below, then quit
+  if( argc > 1 && string( args[1] ) == "--bake-fonts" )
+  {
+    font::get().bake_font_cache( "../resources/font.ttf", 20 );
+    font::get().bake_font_cache( "../resources/font.ttf", 20, true );
+    return 0;
+  }
+
   shape::set_up_intersection();
 
   frm.init( res );
@@ -93,53 +101,75 @@ int main( int argc, char** args )
 
   frm.load_shader( font::get().get_shader(), GL_VERTEX_SHADER, "../shaders/font/font.vs" );
   frm.load_shader( font::get().get_shader(), GL_FRAGMENT_SHADER, "../shaders/font/font.ps" );
+  frm.load_shader( font::get().get_cached_shader(), GL_VERTEX_SHADER, "../shaders/font/cached.vs" );
+  frm.load_shader( font::get().get_cached_shader(), GL_FRAGMENT_SHADER, "../shaders/font/cached.ps" );
 
   font_inst font_instance;
   font::get().resize( res );
   font::get().load_font( "../resources/font.ttf", font_instance, 20 );
 
-  animation anim, anim2;
-
-  anim.set_font( &font_instance );
-  anim.set_duration( 1 );
-  anim.set_loop( false );
-  anim.set_text( L"hello world" );
-  anim.set_font_size( 20 );
-  anim.set_duration( 1 );
-  anim.set_transition( animation::ALPHA, transition::quadratic_inout );
-  anim.set_transition( animation::POSITION, transition::quadratic_inout );
-  anim.turn_on_animation( animation::ALPHA );
-  anim.turn_on_animation( animation::POSITION );
-  anim.turn_on_animation( animation::ROTATION );
-  anim.set_start_rotation( radians( 90 ) );
-  anim.set_end_rotation( radians( 0 ) );
-  anim.set_start_pos( vec3( 300, -330, 0 ) );
-  anim.set_end_pos( vec3( 320, -330, 0 ) );
-  anim.chain_animation( &anim2 );
-  anim.play();
-
-  anim2.set_font( &font_instance );
-  anim2.set_duration( 1 );
-  anim2.set_loop( false );
-  anim2.set_text( L"chained animation" );
-  anim2.set_font_size( 19 );
-  anim2.set_duration( 1 );
-  anim2.set_transition( animation::ALPHA, transition::quadratic_inout );
-  anim2.set_transition( animation::POSITION, transition::quadratic_inout );
-  anim2.turn_on_animation( animation::ALPHA );
-  anim2.turn_on_animation( animation::POSITION );
-  anim2.turn_on_animation( animation::ROTATION );
-  anim2.turn_on_animation( animation::SCALE );
-  anim2.turn_on_animation( animation::SIZE );
-  anim2.set_start_rotation( radians( 90 ) );
-  anim2.set_end_rotation( radians( 0 ) );
-  anim2.set_start_pos( vec3( 420, -330, 0 ) );
-  anim2.set_end_pos( vec3( 440, -330, 0 ) );
-  anim2.set_start_scale( vec3( 1 ) );
-  anim2.set_end_scale( vec3( 1.1 ) );
-  anim2.set_start_size( 20 );
-  anim2.set_end_size( 72 );
-  anim2.set_repeat_amount( 3 );
+  //anim2 tweens its size, an sdf font serves every size from one rasterization
+  font_inst sdf_font_instance;
+  font::get().load_font( "../resources/font.ttf", sdf_font_instance, 20, true );
+
+  animation_batch anims;
+
+  anim_track a;
+  a.f = &font_instance;
+  a.duration = 1;
+  a.font_size = 20;
+  a.props = animation_batch::ALPHA | animation_batch::POSITION | animation_batch::ROTATION;
+  a.trans[0] = transition::quadratic_inout; //alpha
+  a.trans[1] = transition::quadratic_inout; //position
+  a.start_rotation = radians( 90 );
+  a.end_rotation = radians( 0 );
+  a.start_pos = vec3( 300, -330, 0 );
+  a.end_pos = vec3( 320, -330, 0 );
+  unsigned anim = anims.add( a, "hello world" );
+
+  anim_track a2;
+  a2.f = &sdf_font_instance;
+  a2.duration = 1;
+  a2.font_size = 19;
+  a2.props = animation_batch::ALPHA | animation_batch::POSITION | animation_batch::ROTATION | animation_batch::SCALE | animation_batch::SIZE;
+  a2.trans[0] = transition::quadratic_inout;
+  a2.trans[1] = transition::quadratic_inout;
+  a2.start_rotation = radians( 90 );
+  a2.end_rotation = radians( 0 );
+  a2.start_pos = vec3( 420, -330, 0 );
+  a2.end_pos = vec3( 440, -330, 0 );
+  a2.start_scale = vec3( 1 );
+  a2.end_scale = vec3( 1.1 );
+  a2.start_size = 20;
+  a2.end_size = 72;
+  a2.repeat_amount = 3;
+  unsigned anim2 = anims.add( a2, "chained animation" );
+
+  anims.chain( anim, anim2 );
+  anims.play( anim );
+
+  //laid out once, typed in and then waved by font.vs
+  text_effect reveal;
+  reveal.type = FONT_EFFECT_REVEAL;
+  reveal.easing = transition::BACK_OUT;
+  reveal.delay = 0.05f;
+  reveal.duration = 0.3f;
+  reveal.amplitude = 10;
+
+  text_block effect_text;
+  effect_text.set_font( font_instance, 20 );
+  effect_text.set_text( L"every character is animated on the gpu" );
+  effect_text.set_transform( create_translation( vec3( 300, -400, 0 ) ) );
+  effect_text.set_effect( font::get().add_text_effect( reveal ), 1 );
+
+  text_effect wave;
+  wave.type = FONT_EFFECT_WAVE;
+  wave.easing = transition::SINUSOIDAL_INOUT;
+  wave.speed = 0.5f;
+  wave.spread = 0.05f;
+  wave.amplitude = 4;
+  unsigned wave_effect = font::get().add_text_effect( wave );
+  float time = 0;
 
   post_process pp;
   pp.destroy();
@@ -236,8 +266,16 @@ int main( int argc, char** args )
 
     float dt = global_timer.getElapsedTime().asMilliseconds() * 0.001f;
 
-    anim.update( dt );
-    anim2.update( dt );
+    anims.update( dt );
+
+    time += dt;
+    font::get().set_time( time );
+
+    //once every character is in, the wave takes over
+    if( time > 4 && time - dt <= 4 )
+      effect_text.set_effect( wave_effect, time );
+
+    font::get().add_to_render_list( effect_text );
 
     font::get().render();
 
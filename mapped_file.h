@@ -0,0 +1,172 @@
+#ifndef mapped_file_h
+#define mapped_file_h
+
+#include <string>
+#include <cstring>
+#include <stdint.h>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX //std::min / std::max
+#endif
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+//read only memory mapping of a whole file
+//the os pages it in on demand and shares it between processes
+class mapped_file
+{
+private:
+  const unsigned char* data;
+  size_t size;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#else
+  int fd;
+#endif
+
+  mapped_file( const mapped_file& );
+  mapped_file& operator=( const mapped_file& );
+protected:
+public:
+  bool open( const std::string& filename )
+  {
+    close();
+
+#ifdef _WIN32
+    file = CreateFileA( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, 0, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, 0 );
+
+    if( file == INVALID_HANDLE_VALUE )
+      return false;
+
+    LARGE_INTEGER file_size;
+    GetFileSizeEx( file, &file_size );
+    size = (size_t)file_size.QuadPart;
+
+    if( size == 0 )
+    {
+      close();
+      return false;
+    }
+
+    mapping = CreateFileMappingA( file, 0, PAGE_READONLY, 0, 0, 0 );
+
+    if( !mapping )
+    {
+      close();
+      return false;
+    }
+
+    data = (const unsigned char*)MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+#else
+    fd = ::open( filename.c_str(), O_RDONLY );
+
+    if( fd < 0 )
+      return false;
+
+    struct stat st;
+
+    if( fstat( fd, &st ) != 0 || st.st_size == 0 )
+    {
+      close();
+      return false;
+    }
+
+    size = (size_t)st.st_size;
+
+    void* p = mmap( 0, size, PROT_READ, MAP_SHARED, fd, 0 );
+    data = p == MAP_FAILED ? 0 : (const unsigned char*)p;
+#endif
+
+    if( !data )
+    {
+      close();
+      return false;
+    }
+
+    return true;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if( data )
+      UnmapViewOfFile( data );
+
+    if( mapping )
+      CloseHandle( mapping );
+
+    if( file != INVALID_HANDLE_VALUE )
+      CloseHandle( file );
+
+    file = INVALID_HANDLE_VALUE;
+    mapping = 0;
+#else
+    if( data )
+      munmap( (void*)data, size );
+
+    if( fd >= 0 )
+      ::close( fd );
+
+    fd = -1;
+#endif
+
+    data = 0;
+    size = 0;
+  }
+
+  const unsigned char* get_data() const
+  {
+    return data;
+  }
+
+  size_t get_size() const
+  {
+    return size;
+  }
+
+  //fnv-1a style hash of the contents, 8 bytes a step, the high half
+  //is folded back so every byte reaches the low bits too
+  uint64_t hash() const
+  {
+    uint64_t h = 0xcbf29ce484222325ull ^ size;
+    size_t c = 0;
+
+    for( ; c + 8 <= size; c += 8 )
+    {
+      uint64_t w;
+      memcpy( &w, data + c, 8 );
+      h = ( h ^ w ) * 0x100000001b3ull;
+      h ^= h >> 32;
+    }
+
+    for( ; c < size; ++c )
+    {
+      h ^= (unsigned char)data[c];
+      h *= 0x100000001b3ull;
+    }
+
+    return h;
+  }
+
+#ifdef _WIN32
+  mapped_file() : data( 0 ), size( 0 ), file( INVALID_HANDLE_VALUE ), mapping( 0 )
+#else
+  mapped_file() : data( 0 ), size( 0 ), fd( -1 )
+#endif
+  {
+  }
+
+  ~mapped_file()
+  {
+    close();
+  }
+};
+
+#endif
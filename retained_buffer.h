@@ -0,0 +1,147 @@
+#ifndef retained_buffer_h
+#define retained_buffer_h
+
+#include "GL/glew.h"
+
+#include <vector>
+#include <algorithm>
+
+//gpu buffer of long lived elements, handed out in ranges
+//ranges stay put until released, so their data is only uploaded
+//when it changes, free ranges are kept sorted and merged on release
+//the buffer doubles when no free range fits, the old contents
+//are copied on the gpu
+template< class t >
+class retained_buffer
+{
+private:
+  struct range
+  {
+    size_t offset, size;
+  };
+
+  GLuint buffer;
+  size_t capacity; //elements
+  unsigned generation; //changes whenever the buffer object does
+  std::vector<range> free_ranges; //sorted by offset
+
+  void grow( size_t min_capacity )
+  {
+    size_t new_capacity = std::max( capacity * 2, min_capacity );
+
+    GLuint new_buffer;
+    glGenBuffers( 1, &new_buffer );
+    glBindBuffer( GL_COPY_WRITE_BUFFER, new_buffer );
+    glBufferData( GL_COPY_WRITE_BUFFER, sizeof( t ) * new_capacity, 0, GL_DYNAMIC_DRAW );
+
+    if( buffer )
+    {
+      glBindBuffer( GL_COPY_READ_BUFFER, buffer );
+      glCopyBufferSubData( GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof( t ) * capacity );
+      glDeleteBuffers( 1, &buffer );
+    }
+
+    size_t old_capacity = capacity;
+
+    buffer = new_buffer;
+    capacity = new_capacity;
+    ++generation;
+
+    release( old_capacity, new_capacity - old_capacity );
+  }
+protected:
+public:
+  void set_up( size_t cap )
+  {
+    if( !buffer )
+      grow( cap );
+  }
+
+  void destroy()
+  {
+    glDeleteBuffers( 1, &buffer );
+    buffer = 0;
+    capacity = 0;
+    free_ranges.clear();
+  }
+
+  //first fit, returns the offset of the range
+  size_t allocate( size_t n )
+  {
+    for( ;; )
+    {
+      for( size_t c = 0; c < free_ranges.size(); ++c )
+      {
+        range& r = free_ranges[c];
+
+        if( r.size >= n )
+        {
+          size_t offset = r.offset;
+          r.offset += n;
+          r.size -= n;
+
+          if( r.size == 0 )
+            free_ranges.erase( free_ranges.begin() + c );
+
+          return offset;
+        }
+      }
+
+      grow( capacity + n );
+    }
+  }
+
+  void release( size_t offset, size_t n )
+  {
+    if( n == 0 )
+      return;
+
+    range r = { offset, n };
+
+    auto it = std::lower_bound( free_ranges.begin(), free_ranges.end(), r,
+                                []( const range & a, const range & b )
+    {
+      return a.offset < b.offset;
+    } );
+
+    it = free_ranges.insert( it, r );
+
+    //merge with the next, then the previous neighbour
+    if( it + 1 != free_ranges.end() && it->offset + it->size == ( it + 1 )->offset )
+    {
+      it->size += ( it + 1 )->size;
+      free_ranges.erase( it + 1 );
+    }
+
+    if( it != free_ranges.begin() && ( it - 1 )->offset + ( it - 1 )->size == it->offset )
+    {
+      ( it - 1 )->size += it->size;
+      free_ranges.erase( it );
+    }
+  }
+
+  void update( size_t offset, const t* data, size_t n )
+  {
+    if( n == 0 )
+      return;
+
+    glBindBuffer( GL_COPY_WRITE_BUFFER, buffer );
+    glBufferSubData( GL_COPY_WRITE_BUFFER, sizeof( t ) * offset, sizeof( t ) * n, data );
+  }
+
+  GLuint get_buffer()
+  {
+    return buffer;
+  }
+
+  unsigned get_generation()
+  {
+    return generation;
+  }
+
+  retained_buffer() : buffer( 0 ), capacity( 0 ), generation( 0 )
+  {
+  }
+};
+
+#endif
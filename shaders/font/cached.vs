@@ -0,0 +1,26 @@
+#version 430
+
+layout(location=0) uniform mat4 mvp;
+layout(location=1) uniform mat4 transform;
+layout(location=2) uniform vec4 rect; //origin xy, size zw in pixels
+layout(location=3) uniform vec4 clip; //min xy, max xy in window pixels
+
+layout(location=0) in vec2 in_vertex;
+
+out vec2 tex_coord;
+out float gl_ClipDistance[4];
+
+void main()
+{
+  tex_coord = in_vertex;
+
+  //the paragraph moves as a whole, the origin stays where the glyphs were
+  vec2 pos = (transform * vec4(in_vertex * rect.zw, 0, 1)).xy + rect.xy;
+
+  gl_ClipDistance[0] = pos.x - clip.x;
+  gl_ClipDistance[1] = pos.y - clip.y;
+  gl_ClipDistance[2] = clip.z - pos.x;
+  gl_ClipDistance[3] = clip.w - pos.y;
+
+  gl_Position = mvp * vec4(pos, 0, 1);
+}
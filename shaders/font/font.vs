@@ -1,23 +1,148 @@
 #version 430
 
+#define FONT_INSTANCE_DECORATION 1
+#define FONT_INSTANCE_HIGHLIGHT 2
+
+#define FONT_EFFECT_NONE 0u
+#define FONT_EFFECT_WAVE 1u
+#define FONT_EFFECT_SHAKE 2u
+#define FONT_EFFECT_REVEAL 3u
+#define FONT_EFFECT_RAINBOW 4u
+#define FONT_MAX_TEXT_EFFECTS 16
+
+#include "transition.glsl"
+
 layout(location=0) uniform mat4 mvp;
+layout(location=1) uniform uint batch_base;
+layout(location=2) uniform float time; //seconds, see font::set_time
 
 layout(location=0) in vec2 in_vertex;
 layout(location=1) in vec2 in_texture;
-layout(location=2) in vec4 instance_vertscalebias;
-layout(location=3) in vec4 instance_texscalebias;
-layout(location=4) in vec4 instance_color;
-layout(location=6) in mat4 instance_transform;
-layout(location=10) in float instance_filter;
+layout(location=2) in vec2 instance_pos;
+layout(location=3) in uvec2 instance_size;
+layout(location=4) in uint instance_glyph;
+layout(location=5) in uint instance_batch_flags;
+
+struct glyph_batch
+{
+  mat4 transform;
+  vec4 color;
+  vec4 highlight_color;
+  float filter_weight;
+  float scale;
+  uint style;
+  uint effect; //0 for none
+  vec4 clip; //min xy, max xy in window pixels
+  float effect_start;
+};
+
+struct text_effect
+{
+  uint type;
+  uint easing;
+  float speed;
+  float delay;
+  float amplitude;
+  float duration;
+  float spread;
+  float padding;
+};
+
+layout(std140, binding=1) uniform text_effects
+{
+  text_effect effects[FONT_MAX_TEXT_EFFECTS];
+};
+
+layout(std430, binding=1) readonly buffer batches
+{
+  glyph_batch batch_data[];
+};
+
+//vertscalebias, texscalebias pairs
+layout(std430, binding=2) readonly buffer glyph_metrics
+{
+  vec4 glyph_data[];
+};
 
 out vec2 tex_coord;
 flat out vec4 fontcolor;
 flat out float filter_weight;
+flat out uint style;
+out float gl_ClipDistance[4];
+
+//moves and tints character i of its text, t is the time since the effect started
+void apply_effect( text_effect e, uint i, float t, inout vec2 pos, inout vec4 color )
+{
+  switch( e.type )
+  {
+    case FONT_EFFECT_WAVE:
+    {
+      //the easing shapes the way up and down of one period
+      float p = fract( t * e.speed - float( i ) * e.spread );
+      pos.y += e.amplitude * transition_ease( e.easing, 1 - abs( p * 2 - 1 ) );
+      break;
+    }
+    case FONT_EFFECT_SHAKE:
+    {
+      //a new random offset per character speed times a second
+      vec2 seed = vec2( float( i ), floor( t * e.speed ) );
+      vec2 r = fract( sin( vec2( dot( seed, vec2( 12.9898, 78.233 ) ), dot( seed, vec2( 39.3468, 11.135 ) ) ) ) * 43758.5453 );
+      pos += ( r * 2 - 1 ) * e.amplitude;
+      break;
+    }
+    case FONT_EFFECT_REVEAL:
+    {
+      //hidden until its turn, then fades in while rising by amplitude
+      float x = t - float( i ) * e.delay;
+      x = e.duration > 0 ? clamp( x / e.duration, 0, 1 ) : step( 0, x );
+      float a = transition_ease( e.easing, x );
+      pos.y -= e.amplitude * ( 1 - a );
+      color.a *= clamp( a, 0, 1 );
+      break;
+    }
+    case FONT_EFFECT_RAINBOW:
+    {
+      float h = fract( t * e.speed - float( i ) * e.spread );
+      color.rgb *= clamp( abs( fract( h + vec3( 0, 2.0 / 3.0, 1.0 / 3.0 ) ) * 6 - 3 ) - 1, 0, 1 );
+      break;
+    }
+    default:
+      break;
+  }
+}
 
 void main()
 {
-  filter_weight = instance_filter;
-  fontcolor = instance_color;
-  tex_coord = in_texture.xy * instance_texscalebias.xy + instance_texscalebias.zw;
-  gl_Position = (mvp) * vec4((instance_transform * vec4(in_vertex.xy * instance_vertscalebias.xy, 0, 1)).xy + instance_vertscalebias.zw, 0, 1);
+  glyph_batch b = batch_data[batch_base + (instance_batch_flags >> 8)];
+  uint flags = instance_batch_flags & 0xff;
+
+  vec4 vertscalebias = glyph_data[instance_glyph * 2] * b.scale;
+  vec4 texscalebias = glyph_data[instance_glyph * 2 + 1];
+
+  style = b.style;
+
+  if( (flags & FONT_INSTANCE_DECORATION) != 0 )
+  {
+    vertscalebias = vec4(vec2(instance_size) / 8.0, 0, 0);
+    style = 0;
+  }
+
+  filter_weight = b.filter_weight;
+  fontcolor = (flags & FONT_INSTANCE_HIGHLIGHT) != 0 ? b.highlight_color : b.color;
+  tex_coord = in_texture.xy * texscalebias.xy + texscalebias.zw;
+  vec2 origin = instance_pos;
+
+  //glyphs carry their character index in the size, decorations stay put
+  if( b.effect != 0u && (flags & FONT_INSTANCE_DECORATION) == 0 )
+    apply_effect( effects[b.effect], instance_size.x | (instance_size.y << 16), time - b.effect_start, origin, fontcolor );
+
+  vec2 pos = (b.transform * vec4(in_vertex.xy * vertscalebias.xy, 0, 1)).xy + vertscalebias.zw + origin;
+
+  //glyphs partly outside the clip rect are cut by the rasterizer
+  gl_ClipDistance[0] = pos.x - b.clip.x;
+  gl_ClipDistance[1] = pos.y - b.clip.y;
+  gl_ClipDistance[2] = b.clip.z - pos.x;
+  gl_ClipDistance[3] = b.clip.w - pos.y;
+
+  gl_Position = (mvp) * vec4(pos, 0, 1);
 }
@@ -0,0 +1,79 @@
+//the easing curves of transition.h, by transition::easing id
+//LINEAR is 0, then in, out, inout of each family in this order
+#define TRANSITION_QUADRATIC 0u
+#define TRANSITION_CUBIC 1u
+#define TRANSITION_QUARTIC 2u
+#define TRANSITION_QUINTIC 3u
+#define TRANSITION_SINUSOIDAL 4u
+#define TRANSITION_EXPONENTIAL 5u
+#define TRANSITION_CIRCULAR 6u
+#define TRANSITION_ELASTIC 7u
+#define TRANSITION_BACK 8u
+#define TRANSITION_BOUNCE 9u
+#define TRANSITION_NUM_FAMILIES 10u
+
+#define TRANSITION_PI 3.14159265
+
+//the in curve of a family, same as transition::in4
+float transition_in( uint f, float x )
+{
+  switch( f )
+  {
+    case TRANSITION_QUADRATIC:
+      return x * x;
+    case TRANSITION_CUBIC:
+      return x * x * x;
+    case TRANSITION_QUARTIC:
+      return x * x * x * x;
+    case TRANSITION_QUINTIC:
+      return x * x * x * x * x;
+    case TRANSITION_SINUSOIDAL:
+      return sin( x * 0.5 * TRANSITION_PI - 0.5 * TRANSITION_PI ) + 1;
+    case TRANSITION_EXPONENTIAL:
+      return x < 0.001 ? 0.0 : exp2( ( x - 1 ) * 10 );
+    case TRANSITION_CIRCULAR:
+      return 1 - sqrt( max( 0.0, 1 - x * x ) );
+    case TRANSITION_ELASTIC:
+      //a = 1, s = p / 4, p = 0.4
+      if( x < 0.001 ) return 0.0;
+      if( x >= 0.999 ) return 1.0;
+      return exp2( ( x - 1 ) * 10 ) * sin( ( x - 0.1 ) * 2 * TRANSITION_PI / 0.4 );
+    case TRANSITION_BACK:
+      return x * x * ( x * 2.70158 - 1.70158 );
+    case TRANSITION_BOUNCE:
+    {
+      float y = 1 - x;
+      float r;
+
+      if( y < 1 / 2.75 )
+        r = 7.5625 * y * y;
+      else if( y < 2 / 2.75 )
+        r = 7.5625 * ( y - 1.5 / 2.75 ) * ( y - 1.5 / 2.75 ) + 0.75;
+      else if( y < 2.5 / 2.75 )
+        r = 7.5625 * ( y - 2.25 / 2.75 ) * ( y - 2.25 / 2.75 ) + 0.9375;
+      else
+        r = 7.5625 * ( y - 2.625 / 2.75 ) * ( y - 2.625 / 2.75 ) + 0.984375;
+
+      return 1 - r;
+    }
+    default:
+      return x;
+  }
+}
+
+//x in [0, 1] through easing e, unknown ids are linear like transition::get
+float transition_ease( uint e, float x )
+{
+  uint f = ( e - 1u ) / 3u, kind = ( e - 1u ) % 3u;
+
+  if( e == 0u || f >= TRANSITION_NUM_FAMILIES )
+    return x;
+
+  if( kind == 0u )
+    return transition_in( f, x );
+
+  if( kind == 1u )
+    return 1 - transition_in( f, 1 - x );
+
+  return x < 0.5 ? transition_in( f, x * 2 ) * 0.5 : ( 1 - transition_in( f, 2 - x * 2 ) ) * 0.5 + 0.5;
+}
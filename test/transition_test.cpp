@@ -0,0 +1,56 @@
+//ease4 and ease_table against the scalar functions they stand in for,
+//at 1001 points of every easing, exits with 1 on a mismatch
+
+#include "transition.h"
+
+#include <cmath>
+#include <iostream>
+
+#define TRANSITION_TEST_POINTS 1001
+
+int main()
+{
+  //the kernels only differ by rounding, the tables by their
+  //interpolation, the elastic curves bend the most between samples
+  const float kernel_tolerance = 1e-4f, table_tolerance = 2e-3f;
+  unsigned failures = 0;
+
+  for( unsigned e = 0; e < transition::NUM_EASINGS; ++e )
+  {
+    transition::func f = transition::get( e );
+    float kernel_error = 0, table_error = 0;
+
+    //4 points a call, the last call is partly past the end
+    for( unsigned i = 0; i < TRANSITION_TEST_POINTS; i += 4 )
+    {
+      float x[4];
+
+      for( unsigned l = 0; l < 4; ++l )
+        x[l] = std::min( i + l, unsigned( TRANSITION_TEST_POINTS - 1 ) ) / float( TRANSITION_TEST_POINTS - 1 );
+
+      mm::vec4 v = transition::ease4( e, mm::vec4( x[0], x[1], x[2], x[3] ) );
+      mm::vec4 t = transition::ease4_table( e, mm::vec4( x[0], x[1], x[2], x[3] ) );
+      float vs[4] = { v.x, v.y, v.z, v.w }, ts[4] = { t.x, t.y, t.z, t.w };
+
+      for( unsigned l = 0; l < 4; ++l )
+      {
+        float r = f( x[l] );
+        kernel_error = std::max( kernel_error, std::abs( vs[l] - r ) );
+        table_error = std::max( table_error, std::abs( ts[l] - r ) );
+      }
+    }
+
+    if( kernel_error > kernel_tolerance || table_error > table_tolerance )
+    {
+      std::cerr << "easing " << e << ": ease4 off by " << kernel_error << ", ease_table off by " << table_error << std::endl;
+      ++failures;
+    }
+  }
+
+  if( failures )
+    return 1;
+
+  std::cout << "all " << unsigned( transition::NUM_EASINGS ) << " easings match at " << TRANSITION_TEST_POINTS << " points" << std::endl;
+
+  return 0;
+}
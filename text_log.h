@@ -0,0 +1,306 @@
+#ifndef text_log_h
+#define text_log_h
+
+#include "font.h"
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#define TEXT_LOG_CHUNK_SIZE 256 //lines
+#define TEXT_LOG_DEFAULT_CAPACITY ( 1 << 20 ) //lines
+
+//scrollback log with an unbounded history
+//lines live in fixed size chunks that are recycled oldest first once the
+//capacity is reached, every line caches its row count and every chunk the
+//rows before it, so finding the line at a scroll position is two binary
+//searches, only the lines inside the viewport get a text_block
+class text_log
+{
+private:
+  struct chunk
+  {
+    std::vector<std::string> lines; //utf-8
+    std::vector<unsigned> rows_before; //prefix sum of the row counts within the chunk
+    size_t first_row; //rows added to the log before this chunk
+    size_t first_line; //lines added to the log before this chunk
+    unsigned rows;
+  };
+
+  struct visible_line
+  {
+    size_t line; //lines added to the log before this one
+    double y; //last transform, in pixels
+    text_block* block;
+  };
+
+  std::deque<chunk*> chunks; //oldest first
+  size_t capacity; //lines
+  size_t num_lines;
+  size_t lines_added, rows_added; //since the log was created
+  font_inst* f;
+  unsigned size;
+  float line_height;
+  mm::vec4 color, highlight_color;
+  mm::vec2 view_pos, view_size; //top left, in pixels from the top left of the screen
+  double scroll_pos; //pixels from the top of the first line ever added
+  bool follow; //stay at the newest line
+  bool colors_changed;
+  std::vector<visible_line> visible, next_visible;
+  std::vector<text_block*> free_blocks;
+
+  text_log( const text_log& );
+  text_log& operator=( const text_log& );
+
+  void new_chunk()
+  {
+    chunk* c;
+
+    if( !chunks.empty() && num_lines + TEXT_LOG_CHUNK_SIZE > capacity )
+    {
+      //the ring is full, the oldest chunk becomes the newest
+      c = chunks.front();
+      chunks.pop_front();
+      num_lines -= c->lines.size();
+      c->lines.clear();
+      c->rows_before.clear();
+    }
+    else
+    {
+      c = new chunk();
+      c->lines.reserve( TEXT_LOG_CHUNK_SIZE );
+      c->rows_before.reserve( TEXT_LOG_CHUNK_SIZE );
+    }
+
+    c->first_row = rows_added;
+    c->first_line = lines_added;
+    c->rows = 0;
+    chunks.push_back( c );
+  }
+
+  //chunk and line holding row, counted from the first line ever added
+  void find_row( size_t row, size_t& chunk_idx, size_t& line_idx )
+  {
+    auto it = std::upper_bound( chunks.begin(), chunks.end(), row,
+                                []( size_t r, const chunk * c )
+    {
+      return r < c->first_row;
+    } );
+
+    chunk_idx = it - chunks.begin() - 1;
+
+    const chunk* c = chunks[chunk_idx];
+    auto lit = std::upper_bound( c->rows_before.begin(), c->rows_before.end(), unsigned( row - c->first_row ) );
+
+    line_idx = lit - c->rows_before.begin() - 1;
+  }
+
+  //the block that showed line last frame, or a free one
+  text_block* take_block( size_t line, size_t& search_from, bool& is_new )
+  {
+    //both lists are sorted by line
+    while( search_from < visible.size() && visible[search_from].line < line )
+      ++search_from;
+
+    if( search_from < visible.size() && visible[search_from].line == line )
+    {
+      is_new = false;
+      text_block* b = visible[search_from].block;
+      visible[search_from].block = 0;
+      return b;
+    }
+
+    is_new = true;
+
+    if( !free_blocks.empty() )
+    {
+      text_block* b = free_blocks.back();
+      free_blocks.pop_back();
+      return b;
+    }
+
+    return new text_block();
+  }
+protected:
+public:
+  void set_font( font_inst& font_ptr, unsigned s, float lh = 1 )
+  {
+    f = &font_ptr;
+    size = s;
+    line_height = lh;
+  }
+
+  void set_color( const mm::vec4& c )
+  {
+    color = c;
+    colors_changed = true;
+  }
+
+  void set_highlight_color( const mm::vec4& c )
+  {
+    highlight_color = c;
+    colors_changed = true;
+  }
+
+  void set_viewport( const mm::vec2& pos, const mm::vec2& s )
+  {
+    view_pos = pos;
+    view_size = s;
+  }
+
+  //the oldest lines are dropped beyond this, rounded to whole chunks
+  void set_capacity( size_t lines )
+  {
+    capacity = std::max( lines, (size_t)TEXT_LOG_CHUNK_SIZE * 2 );
+  }
+
+  void add_line( const utf8_view& text )
+  {
+    if( chunks.empty() || chunks.back()->lines.size() == TEXT_LOG_CHUNK_SIZE )
+      new_chunk();
+
+    chunk* c = chunks.back();
+    //a newline byte is never part of a multi byte sequence
+    unsigned rows = 1 + std::count( text.data, text.data + text.size, '\n' );
+
+    c->rows_before.push_back( c->rows );
+    c->lines.push_back( std::string( text.data, text.size ) );
+    c->rows += rows;
+
+    ++num_lines;
+    ++lines_added;
+    rows_added += rows;
+  }
+
+  void add_line( const std::wstring& text )
+  {
+    std::string s;
+    utf8_append( text, s );
+    add_line( utf8_view( s ) );
+  }
+
+  //positive is towards the newest line
+  void scroll( float pixels )
+  {
+    scroll_pos += pixels;
+    follow = false;
+  }
+
+  void scroll_to_end()
+  {
+    follow = true;
+  }
+
+  size_t get_num_lines()
+  {
+    return num_lines;
+  }
+
+  //lays out and draws only the lines in the viewport
+  void render()
+  {
+    if( !f || chunks.empty() )
+      return;
+
+    double rh = font::get().line_advance( *f, size, line_height );
+
+    if( rh <= 0 )
+      return;
+
+    size_t oldest_row = chunks.front()->first_row;
+    double min_scroll = oldest_row * rh;
+    double max_scroll = std::max( min_scroll, rows_added * rh - view_size.y );
+
+    if( follow || scroll_pos >= max_scroll )
+    {
+      scroll_pos = max_scroll;
+      follow = true;
+    }
+
+    scroll_pos = std::max( scroll_pos, min_scroll );
+
+    size_t first_row = size_t( scroll_pos / rh );
+    size_t last_row = std::min( size_t( ( scroll_pos + view_size.y ) / rh ), rows_added - 1 );
+
+    size_t ci, li;
+    find_row( first_row, ci, li );
+
+    next_visible.clear();
+    size_t search_from = 0;
+
+    //lines half way out of the viewport are cut at its edges
+    font::get().push_clip_rect( mm::vec4( view_pos, view_size ) );
+
+    for( ; ci < chunks.size(); ++ci, li = 0 )
+    {
+      chunk* c = chunks[ci];
+
+      for( ; li < c->lines.size(); ++li )
+      {
+        size_t row = c->first_row + c->rows_before[li];
+
+        if( row > last_row )
+          break;
+
+        bool is_new;
+        visible_line v;
+        v.line = c->first_line + li;
+        v.y = view_pos.y + row * rh - scroll_pos;
+        v.block = take_block( v.line, search_from, is_new );
+
+        if( is_new )
+        {
+          v.block->set_text( c->lines[li] );
+          v.block->set_font( *f, size, line_height );
+        }
+
+        //only a scroll or a move changes the transform
+        if( is_new || v.y != visible[search_from].y )
+          v.block->set_transform( mm::create_translation( mm::vec3( view_pos.x, float( -v.y ), 0 ) ) );
+
+        if( is_new || colors_changed )
+        {
+          v.block->set_color( color );
+          v.block->set_highlight_color( highlight_color );
+        }
+
+        font::get().add_to_render_list( *v.block );
+        next_visible.push_back( v );
+      }
+
+      if( li < c->lines.size() )
+        break;
+    }
+
+    font::get().pop_clip_rect();
+
+    //blocks of lines that scrolled out
+    for( auto& v : visible )
+    {
+      if( v.block )
+        free_blocks.push_back( v.block );
+    }
+
+    visible.swap( next_visible );
+    colors_changed = false;
+  }
+
+  text_log() : capacity( TEXT_LOG_DEFAULT_CAPACITY ), num_lines( 0 ), lines_added( 0 ), rows_added( 0 ), f( 0 ), size( 0 ), line_height( 1 ),
+    color( 1 ), highlight_color( 1 ), view_pos( 0 ), view_size( 0 ), scroll_pos( 0 ), follow( true ), colors_changed( false )
+  {
+  }
+
+  ~text_log()
+  {
+    for( auto& c : chunks )
+      delete c;
+
+    for( auto& v : visible )
+      delete v.block;
+
+    for( auto& b : free_blocks )
+      delete b;
+  }
+};
+
+#endif
@@ -0,0 +1,175 @@
+#ifndef utf8_h
+#define utf8_h
+
+#include <string>
+#include <cstring>
+#include <cwchar>
+#include <stdint.h>
+
+#define UTF8_REPLACEMENT 0xFFFD //U+FFFD, stands in for malformed input
+
+//non owning view of utf-8 text, the text has to outlive it
+//(the tree is c++0x, so there is no std::string_view)
+struct utf8_view
+{
+  const char* data;
+  size_t size;
+
+  utf8_view() : data( 0 ), size( 0 )
+  {
+  }
+
+  utf8_view( const char* s ) : data( s ), size( std::strlen( s ) )
+  {
+  }
+
+  utf8_view( const char* s, size_t n ) : data( s ), size( n )
+  {
+  }
+
+  utf8_view( const std::string& s ) : data( s.data() ), size( s.size() )
+  {
+  }
+};
+
+//decodes the multi byte sequence at p and moves past it
+//malformed, overlong or surrogate sequences give U+FFFD and skip
+//only the lead byte, so one bad byte never eats the text after it
+inline uint32_t utf8_decode( const unsigned char*& p, const unsigned char* end )
+{
+  //sequence length by the top 5 bits of the lead byte,
+  //0 for continuation bytes and invalid leads
+  static const unsigned char lengths[32] =
+  {
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    0, 0, 0, 0, 0, 0, 0, 0, 2, 2, 2, 2, 3, 3, 4, 0
+  };
+  static const uint32_t lead_mask[5] = { 0, 0x7f, 0x1f, 0x0f, 0x07 };
+  static const uint32_t min_value[5] = { 0, 0, 0x80, 0x800, 0x10000 };
+
+  uint32_t c = *p;
+  unsigned n = lengths[c >> 3];
+
+  if( n == 0 || unsigned( end - p ) < n )
+  {
+    ++p;
+    return UTF8_REPLACEMENT;
+  }
+
+  c &= lead_mask[n];
+  unsigned bad = 0;
+
+  for( unsigned i = 1; i < n; ++i )
+  {
+    //continuation bytes are 10xxxxxx
+    bad |= ( p[i] & 0xc0 ) ^ 0x80;
+    c = ( c << 6 ) | ( p[i] & 0x3f );
+  }
+
+  if( bad || c < min_value[n] || c > 0x10ffff || ( c >= 0xd800 && c <= 0xdfff ) )
+  {
+    ++p;
+    return UTF8_REPLACEMENT;
+  }
+
+  p += n;
+  return c;
+}
+
+//walks the codepoints of a view, copies are independent cursors
+//ascii, the common case in game text, costs one compare
+struct utf8_cursor
+{
+  const unsigned char* p;
+  const unsigned char* end;
+
+  bool next( uint32_t& c )
+  {
+    if( p == end )
+      return false;
+
+    if( *p < 0x80 )
+      c = *p++;
+    else
+      c = utf8_decode( p, end );
+
+    return true;
+  }
+
+  utf8_cursor( const utf8_view& v ) : p( (const unsigned char*)v.data ), end( (const unsigned char*)v.data + v.size )
+  {
+  }
+};
+
+//walks wide text, wchar_t is utf-16 on windows and utf-32 elsewhere
+struct wide_cursor
+{
+  const wchar_t* p;
+  const wchar_t* end;
+
+  bool next( uint32_t& c )
+  {
+    if( p == end )
+      return false;
+
+    c = uint32_t( *p++ );
+
+#if WCHAR_MAX <= 0xffff
+    //join surrogate pairs
+    if( c >= 0xd800 && c <= 0xdbff && p != end && *p >= 0xdc00 && *p <= 0xdfff )
+      c = 0x10000 + ( ( c - 0xd800 ) << 10 ) + ( uint32_t( *p++ ) - 0xdc00 );
+#endif
+
+    return true;
+  }
+
+  wide_cursor( const wchar_t* s, size_t n ) : p( s ), end( s + n )
+  {
+  }
+};
+
+inline void utf8_append( uint32_t c, std::string& out )
+{
+  if( c > 0x10ffff || ( c >= 0xd800 && c <= 0xdfff ) )
+    c = UTF8_REPLACEMENT;
+
+  if( c < 0x80 )
+  {
+    out += char( c );
+  }
+  else if( c < 0x800 )
+  {
+    out += char( 0xc0 | ( c >> 6 ) );
+    out += char( 0x80 | ( c & 0x3f ) );
+  }
+  else if( c < 0x10000 )
+  {
+    out += char( 0xe0 | ( c >> 12 ) );
+    out += char( 0x80 | ( ( c >> 6 ) & 0x3f ) );
+    out += char( 0x80 | ( c & 0x3f ) );
+  }
+  else
+  {
+    out += char( 0xf0 | ( c >> 18 ) );
+    out += char( 0x80 | ( ( c >> 12 ) & 0x3f ) );
+    out += char( 0x80 | ( ( c >> 6 ) & 0x3f ) );
+    out += char( 0x80 | ( c & 0x3f ) );
+  }
+}
+
+//appends wide text as utf-8, for callers that still hold wstrings
+inline void utf8_append( const wchar_t* s, size_t n, std::string& out )
+{
+  wide_cursor cur( s, n );
+  uint32_t c;
+
+  while( cur.next( c ) )
+    utf8_append( c, out );
+}
+
+inline void utf8_append( const std::wstring& s, std::string& out )
+{
+  utf8_append( s.data(), s.size(), out );
+}
+
+#endif